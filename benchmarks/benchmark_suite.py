@@ -0,0 +1,158 @@
+"""Timed benchmark scenarios over the synthetic workloads from
+generate_bam.py. Each scenario is run several times and the fastest run
+is reported, as JSON so throughput can be charted per release.
+
+Usage: python benchmarks/benchmark_suite.py [--output results.json]
+"""
+import argparse
+import json
+import os
+import sys
+import tempfile
+import time
+
+from generate_bam import WORKLOADS, _header, write_workload
+
+from htspy.bam import BamReader, BamWriter
+
+# Number of records per workload at scale 1. Long reads are three orders
+# of magnitude bigger than short reads, so far fewer are needed.
+WORKLOAD_SIZES = {
+    "short_read": 50_000,
+    "long_read": 50,
+    "tag_heavy": 20_000,
+}
+
+
+def scenario_iterate(bam_file, output_file):
+    with BamReader(bam_file) as reader:
+        count = 0
+        for record in reader:
+            count += 1
+    return count
+
+
+def scenario_decode(bam_file, output_file):
+    with BamReader(bam_file) as reader:
+        count = 0
+        for record in reader:
+            record.get_sequence()
+            count += 1
+    return count
+
+
+def scenario_cigar(bam_file, output_file):
+    with BamReader(bam_file) as reader:
+        count = 0
+        for record in reader:
+            str(record.cigar)
+            count += 1
+    return count
+
+
+def scenario_tags(bam_file, output_file):
+    with BamReader(bam_file) as reader:
+        count = 0
+        for record in reader:
+            record.get_tags_dict()
+            count += 1
+    return count
+
+
+def scenario_write(bam_file, output_file, records):
+    with BamWriter(output_file, _header()) as writer:
+        writer.write_many(records)
+    return len(records)
+
+
+def scenario_round_trip(bam_file, output_file):
+    with BamReader(bam_file) as reader:
+        with BamWriter(output_file, reader.header) as writer:
+            count = 0
+            for record in reader:
+                writer.write(record)
+                count += 1
+    return count
+
+
+READ_SCENARIOS = {
+    "iterate": scenario_iterate,
+    "decode": scenario_decode,
+    "cigar": scenario_cigar,
+    "tags": scenario_tags,
+    "round_trip": scenario_round_trip,
+}
+
+
+def timed(function, *args, repeats: int):
+    best = None
+    for _ in range(repeats):
+        start = time.perf_counter()
+        count = function(*args)
+        elapsed = time.perf_counter() - start
+        if best is None or elapsed < best:
+            best = elapsed
+    return count, best
+
+
+def run_suite(scale: float, repeats: int):
+    results = []
+    with tempfile.TemporaryDirectory() as temp_dir:
+        for workload in WORKLOADS:
+            number_of_records = max(1, int(WORKLOAD_SIZES[workload] * scale))
+            bam_file = os.path.join(temp_dir, f"{workload}.bam")
+            output_file = os.path.join(temp_dir, "out.bam")
+            write_workload(bam_file, workload, number_of_records)
+            scenarios = dict(READ_SCENARIOS)
+            for name, function in scenarios.items():
+                count, elapsed = timed(function, bam_file, output_file,
+                                       repeats=repeats)
+                results.append(make_result(workload, name, count, elapsed,
+                                           os.path.getsize(bam_file)))
+            # The write scenario serializes pre-built records, so record
+            # construction is not part of the timing.
+            with BamReader(bam_file) as reader:
+                records = list(reader)
+            count, elapsed = timed(scenario_write, bam_file, output_file,
+                                   records, repeats=repeats)
+            results.append(make_result(workload, "write", count, elapsed,
+                                       os.path.getsize(output_file)))
+    return results
+
+
+def make_result(workload, scenario, count, elapsed, file_size):
+    return {
+        "workload": workload,
+        "scenario": scenario,
+        "records": count,
+        "seconds": elapsed,
+        "records_per_second": count / elapsed,
+        "file_size": file_size,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--output", help="Write the JSON results to this "
+                                         "file as well as stdout.")
+    parser.add_argument("--scale", type=float, default=1.0,
+                        help="Multiply the workload sizes by this factor.")
+    parser.add_argument("--repeats", type=int, default=3,
+                        help="Runs per scenario, fastest is reported.")
+    args = parser.parse_args()
+    results = run_suite(args.scale, args.repeats)
+    report = {
+        "platform": sys.platform,
+        "python_version": sys.version.split()[0],
+        "timestamp": time.strftime("%Y-%m-%dT%H:%M:%S%z"),
+        "results": results,
+    }
+    output = json.dumps(report, indent=2)
+    print(output)
+    if args.output:
+        with open(args.output, "wt") as output_file:
+            output_file.write(output + "\n")
+
+
+if __name__ == "__main__":
+    main()
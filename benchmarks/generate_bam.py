@@ -0,0 +1,107 @@
+"""Generate synthetic BAM files with representative workloads for the
+benchmark suite. The record content is random but seeded, so the same
+workload is generated on every run."""
+import random
+import sys
+
+from htspy._bam import BamRecord, Cigar
+from htspy.bam import BamHeader, BamReference, BamWriter
+
+REFERENCE_NAME = "chr1"
+REFERENCE_LENGTH = 200_000_000
+
+
+def _header() -> BamHeader:
+    return BamHeader(f"@SQ\tSN:{REFERENCE_NAME}\tLN:{REFERENCE_LENGTH}\n",
+                     [BamReference(REFERENCE_NAME, REFERENCE_LENGTH)])
+
+
+def _random_sequence(rng: random.Random, length: int) -> str:
+    return "".join(rng.choices("ACGT", k=length))
+
+
+def _random_qualities(rng: random.Random, length: int) -> bytes:
+    return bytes(rng.choices(range(2, 42), k=length))
+
+
+def short_read_records(number_of_records: int, seed: int = 42):
+    """Typical 150 bp short reads with a simple cigar and a few tags."""
+    rng = random.Random(seed)
+    cigar = Cigar("150M")
+    for i in range(number_of_records):
+        record = BamRecord(reference_id=0, position=i * 50,
+                           read_name=b"shortread_%d" % i, mapping_quality=60)
+        record.cigar = cigar
+        record.set_sequence(_random_sequence(rng, 150),
+                            _random_qualities(rng, 150))
+        record.set_tags({"RG": "sample1", "NM": rng.randrange(5),
+                         "AS": rng.randrange(100, 150)})
+        yield record
+
+
+def long_read_records(number_of_records: int, seed: int = 42,
+                      read_length: int = 100_000):
+    """100 kb long reads with several thousand cigar operations."""
+    rng = random.Random(seed)
+    # Short match stretches interleaved with insertions and deletions,
+    # about 6000 operations for a 100 kb read.
+    cigar_chunk = [(0, 45), (1, 3), (2, 2)]  # 45M3I2D, consumes 48 bases.
+    chunks = read_length // 48
+    cigar_ops = cigar_chunk * chunks
+    remainder = read_length - chunks * 48
+    if remainder:
+        cigar_ops.append((0, remainder))
+    cigar = Cigar.from_iter(cigar_ops)
+    for i in range(number_of_records):
+        record = BamRecord(reference_id=0, position=i * 1000,
+                           read_name=b"longread_%d" % i, mapping_quality=60)
+        record.cigar = cigar
+        record.set_sequence(_random_sequence(rng, read_length),
+                            _random_qualities(rng, read_length))
+        record.set_tags({"RG": "sample1", "NM": rng.randrange(2000)})
+        yield record
+
+
+def tag_heavy_records(number_of_records: int, seed: int = 42):
+    """150 bp single-cell style reads carrying ten barcode and count tags."""
+    rng = random.Random(seed)
+    cigar = Cigar("150M")
+    for i in range(number_of_records):
+        record = BamRecord(reference_id=0, position=i * 50,
+                           read_name=b"cellread_%d" % i, mapping_quality=60)
+        record.cigar = cigar
+        record.set_sequence(_random_sequence(rng, 150),
+                            _random_qualities(rng, 150))
+        cell_barcode = _random_sequence(rng, 16)
+        umi = _random_sequence(rng, 12)
+        record.set_tags({
+            "CB": cell_barcode + "-1",
+            "CR": cell_barcode,
+            "CY": "I" * 16,
+            "UB": umi,
+            "UR": umi,
+            "UY": "I" * 12,
+            "GX": "ENSG%011d" % rng.randrange(100_000),
+            "GN": "GENE%d" % rng.randrange(100_000),
+            "NM": rng.randrange(5),
+            "AS": rng.randrange(100, 150),
+        })
+        yield record
+
+
+WORKLOADS = {
+    "short_read": short_read_records,
+    "long_read": long_read_records,
+    "tag_heavy": tag_heavy_records,
+}
+
+
+def write_workload(filename: str, workload: str, number_of_records: int,
+                   compresslevel=None):
+    with BamWriter(filename, _header(), compresslevel=compresslevel) as writer:
+        for record in WORKLOADS[workload](number_of_records):
+            writer.write(record)
+
+
+if __name__ == "__main__":
+    write_workload(sys.argv[2], sys.argv[1], int(sys.argv[3]))
@@ -57,6 +57,8 @@ setup(
         "(platform.machine == 'x86_64' or platform.machine == 'AMD64')": ['isal']
     },
     ext_modules=[
-        Extension("htspy._bam", ["src/htspy/_bammodule.c"])
+        Extension("htspy._bam", ["src/htspy/_bammodule.c"]),
+        Extension("htspy._bgzf", ["src/htspy/_bgzfmodule.c"],
+                  libraries=["z"]),
     ],
 )
@@ -18,7 +18,7 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
-from typing import Iterable, Iterator, Optional, Tuple, Union
+from typing import Dict, Iterable, Iterator, List, Optional, Sequence, Tuple, Union
 
 class Cigar:
     def __init__(self, cigar_string: str): ...
@@ -32,6 +32,10 @@ class Cigar:
     @property
     def number_of_operations(self) -> int: ...
 
+    def reference_length(self) -> int: ...
+    def query_length(self) -> int: ...
+    def clipped_lengths(self) -> Tuple[int, int]: ...
+
     @classmethod
     def from_buffer(cls, __buffer) -> Cigar: ...
     @classmethod
@@ -66,18 +70,98 @@ class BamRecord:
     read_name: str
     qualities: bytes
     cigar: Cigar
+    reference_end: int
 
     def get_sequence(self) -> str: ...
 
     def set_sequence(self, __sequence: str,
                            __qualities: Optional[bytes] = None) -> None: ...
+    def get_quality_string(self) -> str: ...
+    def set_quality_string(self, __qualities: str) -> None: ...
     def to_bytes(self) -> bytes: ...
+    def to_sam_line(self, __references: Sequence[str]) -> str: ...
+
+    @classmethod
+    def from_bytes(cls, __data) -> BamRecord: ...
 
     def get_tag(self, tag: str) -> Union[str, int, float, memoryview]: ...
 
+    def get_tags_dict(self) -> Dict[str, Union[str, int, float, memoryview]]: ...
+
     def set_tag(self, __tag: str, __value, value_type: Optional[str] = None): ...
+    def set_tags(self, __tags: Dict[str, object]) -> None: ...
+
+class LazyBamRecord:
+    _block_size: int
+    _refID: int
+    _pos: int
+    _l_read_name: int
+    _mapq: int
+    _bin: int
+    _n_cigar_op: int
+    _flag: int
+    _l_seq: int
+    _next_refID: int
+    _next_pos: int
+    _tlen: int
+    _read_name: bytes
+    _cigar: Cigar
+    _seq: bytes
+    _qual: bytes
+    _tags: bytes
+
+    reference_id: int
+    position: int
+    mapping_quality: int
+    flag: int
+    next_position: int
+    template_length: int
+    read_name: str
+    qualities: bytes
+    cigar: Cigar
+    reference_end: int
+
+    def get_sequence(self) -> str: ...
+    def get_quality_string(self) -> str: ...
+    def to_bytes(self) -> bytes: ...
+    def to_sam_line(self, __references: Sequence[str]) -> str: ...
+    def get_tag(self, tag: str) -> Union[str, int, float, memoryview]: ...
+    def get_tags_dict(self) -> Dict[str, Union[str, int, float, memoryview]]: ...
 
-def bam_iterator(data) -> Iterator[BamRecord]: ...
+class BamIterator(Iterator[Union[BamRecord, LazyBamRecord]]):
+    records_yielded: int
+
+def bam_iterator(data, lazy: bool = False, views: bool = False,
+                 recycle: bool = False,
+                 flag_include: int = 0, flag_exclude: int = 0,
+                 min_mapq: int = 0,
+                 region: Optional[Tuple[int, int, int]] = None) \
+    -> BamIterator: ...
+
+def decode_sequences(__data) -> List[str]: ...
+
+def bam_block_to_columns(__data) -> Dict[str, memoryview]: ...
+
+def bam_block_to_sam(__data, __references: Sequence[str]) -> str: ...
+
+def sort_bam_records(__data) -> bytes: ...
+
+def cigars_to_strings(__cigars: Sequence[Cigar]) -> List[str]: ...
+
+class BamMergeIterator(Iterator[bytes]): ...
+
+def merge_bam_records(
+        __iterables: Sequence[Iterable]) -> BamMergeIterator: ...
+
+class BamReferenceTable(Sequence):
+    def __len__(self) -> int: ...
+    def __getitem__(self, __index: int): ...
+
+def scan_bam_references(__data, __offset: int,
+                        __count: int) -> Tuple[int, int]: ...
+
+def parse_bam_references(__data: bytes, __number_of_references: int,
+                         __factory=None) -> BamReferenceTable: ...
 
 class BamBlockBuffer:
     buffersize: int
@@ -87,6 +171,9 @@ class BamBlockBuffer:
 
     def write(self, __bam_record: BamRecord) -> int: ...
 
+    def write_many(self, __bam_records: Sequence[BamRecord],
+                   __start: int = 0) -> int: ...
+
     def reset(self): ...  
 
     def get_block_view(self) -> memoryview: ...
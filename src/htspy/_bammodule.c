@@ -160,7 +160,9 @@ BamCigar_get_buffer(BamCigar *self, Py_buffer *view, int flags) {
     view->ndim = 1;
     view->shape = NULL;
     if ((flags & PyBUF_ND) == PyBUF_ND)
-        view->shape = &(Py_SIZE(self));
+        // Take the address of ob_size directly as Py_SIZE() no longer
+        // returns an lvalue since Python 3.11.
+        view->shape = &(((PyVarObject *)self)->ob_size);
     view->strides = NULL;
     if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES)
         view->strides = &(view->itemsize);
@@ -174,31 +176,100 @@ static PyBufferProcs BamCigar_as_buffer = {
     .bf_releasebuffer = NULL, // Buffer does not use resources
 };
 
+// All two-digit numbers concatenated, so two digits are emitted with one
+// 2-byte copy instead of two divisions.
+static const char DIGIT_PAIRS[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+static inline size_t
+uint32_decimal_length(uint32_t value)
+{
+    size_t length = 1;
+    while (value >= 10000) {
+        value /= 10000;
+        length += 4;
+    }
+    if (value >= 100) {
+        length += (value >= 1000) ? 3 : 2;
+    } else if (value >= 10) {
+        length += 1;
+    }
+    return length;
+}
+
+/**
+ * @brief Write value in decimal to buffer, two digits at a time, without
+ *        a terminating NULL byte. Returns the number of characters.
+ */
+static inline size_t
+format_uint32(uint32_t value, char *buffer)
+{
+    size_t length = uint32_decimal_length(value);
+    char *pos = buffer + length;
+    while (value >= 100) {
+        uint32_t remainder = value % 100;
+        value /= 100;
+        pos -= 2;
+        memcpy(pos, DIGIT_PAIRS + remainder * 2, 2);
+    }
+    if (value >= 10) {
+        memcpy(buffer, DIGIT_PAIRS + value * 2, 2);
+    } else {
+        buffer[0] = '0' + value;
+    }
+    return length;
+}
+
+/**
+ * @brief Signed variant of format_uint32. Needs at most 11 characters of
+ *        buffer space. Returns the number of characters.
+ */
+static inline size_t
+format_int32(int32_t value, char *buffer)
+{
+    if (value < 0) {
+        buffer[0] = '-';
+        // Negate in 64 bits so INT32_MIN does not overflow.
+        return 1 + format_uint32((uint32_t)(-(int64_t)value), buffer + 1);
+    }
+    return format_uint32((uint32_t)value, buffer);
+}
+
+/**
+ * @brief Format a cigar as text into buffer, which must hold at least
+ *        n_cigar_op * 10 characters. Returns the number of characters.
+ */
+static Py_ssize_t
+format_cigar(const uint32_t *cigar, Py_ssize_t n_cigar_op, char *buffer)
+{
+    Py_ssize_t string_size = 0;
+    for (Py_ssize_t i = 0; i < n_cigar_op; i += 1) {
+        uint32_t cigar_int = cigar[i];
+        string_size += format_uint32(bam_cigar_oplen(cigar_int),
+                                     buffer + string_size);
+        buffer[string_size] = bam_cigar_opchr(cigar_int);
+        string_size += 1;
+    }
+    return string_size;
+}
+
 static PyObject *
 BamCigar__str__(BamCigar *self) {
     // Largest cigar op length is 9 digits (268435455). So 9 digits plus 1
     // op character == 10 characters per cigar op. Assigning max_size memory
     // has the disadvantage that we probably assign way too much memory, but
-    // at the advantage that sprintf can never overshoot, so there is no need
-    // to check, and the memory never has to be resized.
+    // at the advantage that format_cigar can never overshoot, so there is
+    // no need to check, and the memory never has to be resized.
     Py_ssize_t n_cigar_op = Py_SIZE(self);
-    uint32_t * cigar = self->cigar;
     size_t max_size = n_cigar_op * 10;
     char * buffer = PyMem_Malloc(max_size);
     if (buffer == NULL) {
         return PyErr_NoMemory();
     }
-    uint32_t cigar_int;
-    Py_ssize_t string_size = 0;
-    Py_ssize_t i = 0;
-    while (i < n_cigar_op) {
-        cigar_int = cigar[i];
-        // No snprintf, because overshoot is impossible.
-        string_size += sprintf(buffer + string_size, "%d%c",
-                               bam_cigar_oplen(cigar_int),
-                               bam_cigar_opchr(cigar_int));
-        i += 1;
-    }
+    Py_ssize_t string_size = format_cigar(self->cigar, n_cigar_op, buffer);
     // PyUnicode_New is faster than PyUnicode_DecodeASCII, since we do not need
     // to check for ASCII. The above code can never contain non-ASCII characters.
     // This trick was learned from Marcel Martin. Thanks!
@@ -340,6 +411,114 @@ BamCigar_from_buffer(PyTypeObject *type, PyObject *data) {
     return BamCigar_FromPointerAndSize((uint32_t *)buffer.buf, n_cigar_op);
 }
 
+/**
+ * @brief Sum the lengths of the cigar operations selected by consume_mask.
+ *
+ * @param cigar pointer to the raw cigar units. memcpy is used for every
+ *              unit, so the pointer does not need to be aligned and may
+ *              point straight into a record buffer.
+ * @param n_cigar_op number of cigar units.
+ * @param consume_mask 2 selects reference-consuming operations, 1 selects
+ *                     query-consuming operations. See bam_cigar_type.
+ * @return uint64_t the summed operation lengths.
+ */
+static inline uint64_t
+cigar_consumed_length(const uint8_t *cigar, Py_ssize_t n_cigar_op,
+                      uint32_t consume_mask)
+{
+    uint64_t length = 0;
+    for (Py_ssize_t i = 0; i < n_cigar_op; i += 1) {
+        uint32_t c;
+        memcpy(&c, cigar + i * sizeof(uint32_t), sizeof(c));
+        if (bam_cigar_type(bam_cigar_op(c)) & consume_mask) {
+            length += bam_cigar_oplen(c);
+        }
+    }
+    return length;
+}
+
+PyDoc_STRVAR(BamCigar_reference_length__doc__,
+"reference_length($self, /)\n"
+"--\n"
+"\n"
+"The number of reference bases consumed by this cigar.\n"
+"\n"
+"M, D, N, = and X operations consume the reference.\n"
+);
+#define BAM_CIGAR_REFERENCE_LENGTH_METHODDEF    \
+    {"reference_length", (PyCFunction)(void(*)(void))BamCigar_reference_length, \
+    METH_NOARGS, BamCigar_reference_length__doc__}
+
+static PyObject *
+BamCigar_reference_length(BamCigar *self, PyObject *Py_UNUSED(ignore)) {
+    return PyLong_FromUnsignedLongLong(cigar_consumed_length(
+        (const uint8_t *)self->cigar, Py_SIZE(self), 2));
+}
+
+PyDoc_STRVAR(BamCigar_query_length__doc__,
+"query_length($self, /)\n"
+"--\n"
+"\n"
+"The number of query bases consumed by this cigar.\n"
+"\n"
+"M, I, S, = and X operations consume the query.\n"
+);
+#define BAM_CIGAR_QUERY_LENGTH_METHODDEF    \
+    {"query_length", (PyCFunction)(void(*)(void))BamCigar_query_length, \
+    METH_NOARGS, BamCigar_query_length__doc__}
+
+static PyObject *
+BamCigar_query_length(BamCigar *self, PyObject *Py_UNUSED(ignore)) {
+    return PyLong_FromUnsignedLongLong(cigar_consumed_length(
+        (const uint8_t *)self->cigar, Py_SIZE(self), 1));
+}
+
+PyDoc_STRVAR(BamCigar_clipped_lengths__doc__,
+"clipped_lengths($self, /)\n"
+"--\n"
+"\n"
+"The number of clipped bases at the start and at the end of the cigar.\n"
+"\n"
+"Returns a (leading, trailing) tuple summing the S and H operations on\n"
+"either end of the cigar.\n"
+);
+#define BAM_CIGAR_CLIPPED_LENGTHS_METHODDEF    \
+    {"clipped_lengths", (PyCFunction)(void(*)(void))BamCigar_clipped_lengths, \
+    METH_NOARGS, BamCigar_clipped_lengths__doc__}
+
+static PyObject *
+BamCigar_clipped_lengths(BamCigar *self, PyObject *Py_UNUSED(ignore)) {
+    Py_ssize_t n_cigar_op = Py_SIZE(self);
+    uint32_t *cigar = self->cigar;
+    uint64_t leading = 0;
+    uint64_t trailing = 0;
+    Py_ssize_t start = 0;
+    while (start < n_cigar_op) {
+        uint32_t operation = bam_cigar_op(cigar[start]);
+        if ((operation != BAM_CSOFT_CLIP) && (operation != BAM_CHARD_CLIP)) {
+            break;
+        }
+        leading += bam_cigar_oplen(cigar[start]);
+        start += 1;
+    }
+    Py_ssize_t end = n_cigar_op;
+    while (end > start) {
+        uint32_t operation = bam_cigar_op(cigar[end - 1]);
+        if ((operation != BAM_CSOFT_CLIP) && (operation != BAM_CHARD_CLIP)) {
+            break;
+        }
+        trailing += bam_cigar_oplen(cigar[end - 1]);
+        end -= 1;
+    }
+    PyObject *tup = PyTuple_New(2);
+    if (tup == NULL) {
+        return PyErr_NoMemory();
+    }
+    PyTuple_SET_ITEM(tup, 0, PyLong_FromUnsignedLongLong(leading));
+    PyTuple_SET_ITEM(tup, 1, PyLong_FromUnsignedLongLong(trailing));
+    return tup;
+}
+
 PyDoc_STRVAR(BamCigar_init__doc__,
 "__init__($cls, cigarstring, /)\n"
 "--\n"
@@ -421,6 +600,9 @@ BamCigar__new___(PyTypeObject *type, PyObject *args, PyObject *kwargs) {
 static PyMethodDef BamCigar_methods[] = {
     BAM_CIGAR_FROM_ITER_METHODDEF,
     BAM_CIGAR_FROM_BUFFER_METHODDEF,
+    BAM_CIGAR_REFERENCE_LENGTH_METHODDEF,
+    BAM_CIGAR_QUERY_LENGTH_METHODDEF,
+    BAM_CIGAR_CLIPPED_LENGTHS_METHODDEF,
     {NULL}
 };
 
@@ -499,16 +681,21 @@ static PyTypeObject BamCigar_Type = {
     .tp_free = PyObject_Del,
 };
 
+typedef struct {
+    uint16_t key;     // The two tag characters, first character in the high byte.
+    uint32_t offset;  // Offset of the tag in the tags buffer.
+} BamTagIndexEntry;
+
 typedef struct {
     PyObject_HEAD
     uint32_t block_size;
-    int32_t refID; 
-    int32_t pos; 
+    int32_t refID;
+    int32_t pos;
     uint8_t l_read_name;
     uint8_t mapq;
     uint16_t bin;
     uint16_t n_cigar_op;
-    uint16_t flag; 
+    uint16_t flag;
     uint32_t l_seq;
     int32_t next_refID;
     int32_t next_pos;
@@ -520,18 +707,70 @@ typedef struct {
     PyObject * seq;
     PyObject * qual;
     PyObject * tags;
+    // Lazily built index of the tags buffer so repeated get_tag calls do
+    // not rescan the raw tag bytes. NULL until the first get_tag call,
+    // invalidated whenever the tags change.
+    BamTagIndexEntry * tag_index;
+    Py_ssize_t tag_index_length;
 } BamRecord;
 
 # define BAM_PROPERTIES_STRUCT_START offsetof(BamRecord, block_size)
 # define BAM_PROPERTIES_STRUCT_SIZE 36
 
+static PyTypeObject BamRecord_Type;  // Forward declaration
+
+// Freelist of discarded BamRecord objects, like CPython keeps for floats
+// and tuples. In a tight loop over a BAM file the iterator allocates and
+// the loop body frees one record per iteration, so nearly every allocation
+// can be served from here. The read_name slot of a dead record is reused
+// as the next pointer.
+#define BamRecord_MAXFREELIST 80
+static BamRecord *BamRecord_freelist = NULL;
+static int BamRecord_numfree = 0;
+
+static BamRecord *
+BamRecord_New(void) {
+    BamRecord *record;
+    if (BamRecord_freelist != NULL) {
+        record = BamRecord_freelist;
+        BamRecord_freelist = (BamRecord *)record->read_name;
+        BamRecord_numfree -= 1;
+        _Py_NewReference((PyObject *)record);
+    } else {
+        record = PyObject_New(BamRecord, &BamRecord_Type);
+        if (record == NULL) {
+            return NULL;
+        }
+    }
+    record->tag_index = NULL;
+    record->tag_index_length = 0;
+    return record;
+}
+
+static inline void
+BamRecord_invalidate_tag_index(BamRecord *self) {
+    if (self->tag_index != NULL) {
+        PyMem_Free(self->tag_index);
+        self->tag_index = NULL;
+        self->tag_index_length = 0;
+    }
+}
+
 static void
 BamRecord_dealloc(BamRecord *self) {
+    BamRecord_invalidate_tag_index(self);
     Py_CLEAR(self->read_name);
     Py_CLEAR(self->bamcigar);
     Py_CLEAR(self->seq);
     Py_CLEAR(self->qual);
     Py_CLEAR(self->tags);
+    if ((Py_TYPE(self) == &BamRecord_Type) &&
+        (BamRecord_numfree < BamRecord_MAXFREELIST)) {
+        self->read_name = (PyObject *)BamRecord_freelist;
+        BamRecord_freelist = self;
+        BamRecord_numfree += 1;
+        return;
+    }
     Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
@@ -723,51 +962,184 @@ BamRecord_set_tags(BamRecord * self, PyObject * new_tags, void* closure)
     Py_INCREF(new_tags);
     self->tags = new_tags;
     Py_DECREF(old_tags);
+    BamRecord_invalidate_tag_index(self);
     // Make sure the internal sizes are correct after updating.
     self->block_size = self->block_size + new_tags_size - old_tags_size;
     return 0;
 }
 
-PyDoc_STRVAR(BamRecord_cigar_doc, 
+PyDoc_STRVAR(BamRecord_cigar_doc,
 "A BamCigar object representing the CIGAR information.");
 
+// Forward declarations for the tag walkers, needed by the CG tag cigar
+// handling below. The implementations live with the other tag code.
+static const uint8_t *
+skip_tag(const uint8_t *start, const uint8_t *end);
+static int
+find_tag(const uint8_t *tags, size_t tags_length, const uint8_t *tag,
+         const uint8_t **found_tag);
+static int
+_BamRecord_replace_tag(BamRecord *self, const uint8_t *tag,
+                       const uint8_t *tag_marker, size_t tag_marker_length,
+                       uint8_t *tag_value, size_t tag_value_length);
+
+// The n_cigar_op field is 16 bits, so this is the largest cigar that fits
+// in the cigar section of the record. Longer cigars are spilled into the
+// CG tag with a kSmN placeholder in the cigar section. See SAM spec 4.2.2.
+#define BAM_MAX_INLINE_CIGAR_OPS 65535
+
+/**
+ * @brief Check whether a cigar is the dummy kSmN cigar that signals that the
+ *        full cigar is stored in the CG tag.
+ *
+ * @return int 1 if the cigar is a CG tag stub, 0 if it is a real cigar.
+ */
+static int
+cigar_is_cg_stub(const uint32_t *cigar, Py_ssize_t n_cigar_op, uint32_t l_seq) {
+    if (n_cigar_op == 2) {
+        if ((bam_cigar_op(cigar[0]) == BAM_CSOFT_CLIP) &&
+            (bam_cigar_oplen(cigar[0]) == l_seq)) {
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Find and validate the CG:B,I tag that holds a spilled long cigar.
+ *
+ * @param tags pointer to the raw tags buffer.
+ * @param tags_length the length of the tags buffer.
+ * @return const uint8_t* pointer to the start of the tag (the array count
+ *         is at offset 4, the cigar operations at offset 8), or NULL with
+ *         an error set when the tag is absent or malformed.
+ */
+static const uint8_t *
+find_cg_tag(const uint8_t *tags, Py_ssize_t tags_length) {
+    const uint8_t *tag_ptr = NULL;
+    if (find_tag(tags, tags_length, (const uint8_t *)"CG", &tag_ptr) != 0) {
+        return NULL;
+    }
+    if ((tag_ptr == NULL) || ((tags + tags_length) - tag_ptr < 8) ||
+            (tag_ptr[2] != 'B') || (tag_ptr[3] != 'I')) {
+        PyErr_SetString(PyExc_ValueError,
+            "Record signals a long cigar but has no CG:B,I tag");
+        return NULL;
+    }
+    // skip_tag validates that the full array is present in the buffer.
+    if (skip_tag(tag_ptr, tags + tags_length) == NULL) {
+        return NULL;
+    }
+    return tag_ptr;
+}
+
+/**
+ * @brief Build a BamCigar from the CG tag's B,I array in a tags buffer.
+ *
+ * The array bytes are copied straight into the new BamCigar without
+ * creating any intermediate objects.
+ *
+ * @param tags pointer to the raw tags buffer.
+ * @param tags_length the length of the tags buffer.
+ * @return PyObject* the BamCigar or NULL with an error set.
+ */
+static PyObject *
+cigar_from_cg_tag(const uint8_t *tags, Py_ssize_t tags_length) {
+    const uint8_t *tag_ptr = find_cg_tag(tags, tags_length);
+    if (tag_ptr == NULL) {
+        return NULL;
+    }
+    uint32_t n_cigar_op;
+    memcpy(&n_cigar_op, tag_ptr + 4, sizeof(n_cigar_op));
+    return BamCigar_FromPointerAndSize((uint32_t *)(tag_ptr + 8), n_cigar_op);
+}
+
 static PyObject *
 BamRecord_get_cigar(BamRecord * self, void * closure) {
-    if (self->n_cigar_op == 2) {
-        // Initiate CG tag check
-        uint32_t * cigar = BamCigar_GET_CIGAR(self->bamcigar);
-        if ((bam_cigar_op(cigar[0]) == BAM_CSOFT_CLIP) && 
-            (bam_cigar_oplen(cigar[0]) == self->l_seq)) {
-                PyErr_SetString(PyExc_NotImplementedError, 
-                    "Support for cigars longer than 65536 has not yet been implemented.");
-                return NULL;
-            }
+    if (cigar_is_cg_stub(BamCigar_GET_CIGAR(self->bamcigar),
+                         self->n_cigar_op, self->l_seq)) {
+        return cigar_from_cg_tag((uint8_t *)PyBytes_AS_STRING(self->tags),
+                                 PyBytes_GET_SIZE(self->tags));
     }
     Py_INCREF(self->bamcigar);
     return (PyObject *)self->bamcigar;
 }
 
-static int 
+static int
 BamRecord_set_cigar(BamRecord * self, BamCigar * new_cigar, void * closure) {
     if (Py_TYPE(new_cigar) != &BamCigar_Type) {
         PyErr_Format(PyExc_TypeError, "cigar must be of BamCigar type, got %s.",
             Py_TYPE(new_cigar)->tp_name);
-        return -1; 
-    }
-    if (Py_SIZE(new_cigar) > 65536) {
-        PyErr_SetString(PyExc_NotImplementedError, 
-            "Support for cigars longer than 65536 has not yet been implemented.");
         return -1;
     }
+    Py_ssize_t n_cigar_op = Py_SIZE(new_cigar);
+    if (n_cigar_op > BAM_MAX_INLINE_CIGAR_OPS) {
+        // Spill the full cigar into the CG tag and store the kSmN
+        // placeholder in the cigar section, as htslib does.
+        if (n_cigar_op > UINT32_MAX) {
+            PyErr_SetString(PyExc_OverflowError,
+                "Value too big to store in BamRecord");
+            return -1;
+        }
+        uint64_t reference_length = cigar_consumed_length(
+            (const uint8_t *)new_cigar->cigar, n_cigar_op, 2);
+        uint8_t tag_marker[8] = {'C', 'G', 'B', 'I'};
+        uint32_t array_length = (uint32_t)n_cigar_op;
+        memcpy(tag_marker + 4, &array_length, sizeof(array_length));
+        if (_BamRecord_replace_tag(self, (const uint8_t *)"CG",
+                                   tag_marker, sizeof(tag_marker),
+                                   (uint8_t *)new_cigar->cigar,
+                                   n_cigar_op * sizeof(uint32_t)) != 0) {
+            return -1;
+        }
+        uint32_t placeholder[2] = {
+            bam_cigar_gen(self->l_seq, BAM_CSOFT_CLIP),
+            bam_cigar_gen(reference_length, BAM_CREF_SKIP),
+        };
+        PyObject *stub = BamCigar_FromPointerAndSize(placeholder, 2);
+        if (stub == NULL) {
+            return -1;
+        }
+        PyObject *tmp = self->bamcigar;
+        self->bamcigar = stub;
+        self->block_size += (2 - self->n_cigar_op) * sizeof(uint32_t);
+        self->n_cigar_op = 2;
+        Py_DECREF(tmp);
+        return 0;
+    }
+    if (cigar_is_cg_stub(BamCigar_GET_CIGAR(self->bamcigar),
+                         self->n_cigar_op, self->l_seq)) {
+        // The new cigar fits in the cigar section: drop the stale CG tag.
+        if (_BamRecord_replace_tag(self, (const uint8_t *)"CG",
+                                   NULL, 0, NULL, 0) != 0) {
+            return -1;
+        }
+    }
     PyObject * tmp = self->bamcigar;
     Py_INCREF(new_cigar);
     self->bamcigar = (PyObject *)new_cigar;
-    self->n_cigar_op = Py_SIZE(new_cigar);
+    self->block_size += (n_cigar_op - self->n_cigar_op) * sizeof(uint32_t);
+    self->n_cigar_op = n_cigar_op;
     Py_DECREF(tmp);
     return 0;
 }
 
-// Flags 
+PyDoc_STRVAR(BamRecord_reference_end_doc,
+"The 0-based position one past the last reference base the record aligns\n"
+"to. Records without a reference-consuming cigar span one base.");
+
+static PyObject *
+BamRecord_get_reference_end(BamRecord *self, void *closure) {
+    uint64_t reference_length = cigar_consumed_length(
+        (const uint8_t *)BamCigar_GET_CIGAR(self->bamcigar),
+        self->n_cigar_op, 2);
+    if (reference_length == 0) {
+        reference_length = 1;
+    }
+    return PyLong_FromLongLong(self->pos + (int64_t)reference_length);
+}
+
+// Flags
 #define GET_FLAG_PROP(prop_name, FLAG) \
 static PyObject * \
     prop_name(BamRecord *self, void *closure) {\
@@ -831,7 +1203,9 @@ static PyGetSetDef BamRecord_properties[] = {
      BamRecord_tags_doc, NULL},
     {"cigar", (getter)BamRecord_get_cigar, (setter)BamRecord_set_cigar,
      BamRecord_cigar_doc, NULL},
-    {"is_paired", (getter)BamRecord_is_paired, NULL, 
+    {"reference_end", (getter)BamRecord_get_reference_end, NULL,
+     BamRecord_reference_end_doc, NULL},
+    {"is_paired", (getter)BamRecord_is_paired, NULL,
      BamRecord_is_paired_doc, NULL},
     {"is_proper_pair", (getter)BamRecord_is_proper_pair, NULL, 
      BamRecord_is_proper_pair_doc, NULL},
@@ -866,41 +1240,191 @@ PyDoc_STRVAR(BamRecord_get_sequence__doc__,
     {"get_sequence", (PyCFunction)(void(*)(void))BamRecord_get_sequence, \
      METH_NOARGS, BamRecord_get_sequence__doc__}
 
+static void
+decode_nibbles_scalar(const uint8_t *encoded, uint8_t *dest, size_t length)
+{
+    uint16_t * dest_pairs = (uint16_t *)dest;
+    size_t i = 0;
+    // The memory address should be aligned at an even number. Because uint16_t
+    // uses two bytes. Since python strings at UCS4 (4 bytes) this should never
+    // pose a problem.
+    assert(!((size_t)dest_pairs & 1));
+    while (i < length) {
+        dest_pairs[i] = number_to_nucleotide_pair_le[encoded[i]];
+        i += 1;
+    }
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BUILD_SIMD_NIBBLE_DECODE 1
+#include <immintrin.h>
+
+// The 16 IUPAC nucleotide characters indexed by their 4-bit BAM codes.
+// Same order as in htslib's seq_nt16_str.
+#define NIBBLE_TO_NUCLEOTIDE_TABLE \
+    '=', 'A', 'C', 'M', 'G', 'R', 'S', 'V', \
+    'T', 'W', 'Y', 'H', 'K', 'D', 'B', 'N'
+
+__attribute__((target("ssse3")))
+static void
+decode_nibbles_ssse3(const uint8_t *encoded, uint8_t *dest, size_t length)
+{
+    const __m128i table = _mm_setr_epi8(NIBBLE_TO_NUCLEOTIDE_TABLE);
+    const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    // Each iteration looks up 16 high and 16 low nibbles with pshufb and
+    // interleaves them back into 32 decoded bases. The first nucleotide of
+    // each pair is stored in the high nibble.
+    for (; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(encoded + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), nibble_mask);
+        __m128i lo = _mm_and_si128(in, nibble_mask);
+        __m128i first = _mm_shuffle_epi8(table, hi);
+        __m128i second = _mm_shuffle_epi8(table, lo);
+        _mm_storeu_si128((__m128i *)(dest + 2 * i),
+                         _mm_unpacklo_epi8(first, second));
+        _mm_storeu_si128((__m128i *)(dest + 2 * i + 16),
+                         _mm_unpackhi_epi8(first, second));
+    }
+    decode_nibbles_scalar(encoded + i, dest + 2 * i, length - i);
+}
+
+__attribute__((target("avx2")))
+static void
+decode_nibbles_avx2(const uint8_t *encoded, uint8_t *dest, size_t length)
+{
+    const __m256i table = _mm256_setr_epi8(NIBBLE_TO_NUCLEOTIDE_TABLE,
+                                           NIBBLE_TO_NUCLEOTIDE_TABLE);
+    const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(encoded + i));
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble_mask);
+        __m256i lo = _mm256_and_si256(in, nibble_mask);
+        __m256i first = _mm256_shuffle_epi8(table, hi);
+        __m256i second = _mm256_shuffle_epi8(table, lo);
+        // vpunpck interleaves within the two 128-bit lanes, so the lanes
+        // have to be put back in linear order with vperm2i128.
+        __m256i interleave_lo = _mm256_unpacklo_epi8(first, second);
+        __m256i interleave_hi = _mm256_unpackhi_epi8(first, second);
+        _mm256_storeu_si256(
+            (__m256i *)(dest + 2 * i),
+            _mm256_permute2x128_si256(interleave_lo, interleave_hi, 0x20));
+        _mm256_storeu_si256(
+            (__m256i *)(dest + 2 * i + 32),
+            _mm256_permute2x128_si256(interleave_lo, interleave_hi, 0x31));
+    }
+    decode_nibbles_scalar(encoded + i, dest + 2 * i, length - i);
+}
+#endif
+
+// Resolved to the fastest supported implementation in the module init
+// function.
+static void (*decode_nibbles)(
+    const uint8_t *, uint8_t *, size_t) = decode_nibbles_scalar;
+
+/**
+ * @brief Decode a 4-bit encoded BAM sequence into an ASCII string object.
+ *
+ * @param encoded_sequence The nibble-encoded sequence.
+ * @param length The number of bases (l_seq), not the encoded length.
+ * @return PyObject* An ASCII str object or NULL on error.
+ */
 static PyObject *
-BamRecord_get_sequence(BamRecord * self, PyObject * Py_UNUSED(ignore)) {
-    uint32_t length = self->l_seq;
+decode_bam_sequence(const uint8_t *encoded_sequence, Py_ssize_t length)
+{
     PyObject * retval = PyUnicode_New(length, 127);
     if (retval == NULL) {
         return PyErr_NoMemory();
     }
     uint8_t * decoded_sequence = (uint8_t *)PyUnicode_DATA(retval);
-    uint16_t * decoded_sequence_pairs = (uint16_t *)decoded_sequence;
-    uint8_t * encoded_sequence = (uint8_t *)PyBytes_AS_STRING(self->seq);
-    Py_ssize_t encoded_length = PyBytes_GET_SIZE(self->seq);
-    Py_ssize_t i = 0;
-    uint8_t index;
-    // The memory address should be aligned at an even number. Because uint16_t
-    // uses two bytes. Since python strings at UCS4 (4 bytes) this should never
-    // pose a problem.
-    assert(!((size_t)decoded_sequence_pairs & 1));
-    while (i < encoded_length) {
-        index = encoded_sequence[i];
-        decoded_sequence_pairs[i] = number_to_nucleotide_pair_le[index];
-        i += 1;
-    }
+    Py_ssize_t encoded_length = (length + 1) / 2;
+    decode_nibbles(encoded_sequence, decoded_sequence, encoded_length);
     if (length & 1) {
-        // When length is odd, say 7, then 4 encoded bytes are needed to 
+        // When length is odd, say 7, then 4 encoded bytes are needed to
         // store the sequence. This leads to 4 decoded pairs and thus 8 bytes.
-        // Since we only requested 7 bytes when creating the return string, 
-        // the above algorithm overshoots slightly. This is not a problem, 
-        // since CPython always allocates 1 byte of extra space for the 
-        // terminating NULL byte. This NULL byte will have been overwritten, 
+        // Since we only requested 7 bytes when creating the return string,
+        // the above algorithm overshoots slightly. This is not a problem,
+        // since CPython always allocates 1 byte of extra space for the
+        // terminating NULL byte. This NULL byte will have been overwritten,
         // so we have to put it back.
         decoded_sequence[length] = 0;
     }
     return retval;
 }
 
+static PyObject *
+BamRecord_get_sequence(BamRecord * self, PyObject * Py_UNUSED(ignore)) {
+    return decode_bam_sequence((uint8_t *)PyBytes_AS_STRING(self->seq),
+                               self->l_seq);
+}
+
+#ifdef BUILD_SIMD_NIBBLE_DECODE
+__attribute__((target("ssse3")))
+static Py_ssize_t
+encode_nibbles_ssse3(const uint8_t *sequence, uint8_t *encoded,
+                     Py_ssize_t length)
+{
+    // IUPAC nucleotide codes for the characters 0x40-0x4f and 0x50-0x5f,
+    // indexed by the low nibble of the character. These are the rows 64-79
+    // and 80-95 of nucleotide_to_number. -1 marks invalid characters.
+    const __m128i codes_4x = _mm_setr_epi8(
+        -1, 1, 14, 2, 13, -1, -1, 4, 11, -1, -1, 12, -1, 3, 15, -1);
+    const __m128i codes_5x = _mm_setr_epi8(
+        -1, -1, 5, 6, 8, -1, 7, 9, -1, 10, -1, -1, -1, -1, -1, -1);
+    const __m128i low_nibble_mask = _mm_set1_epi8(0x0f);
+    const __m128i high_nibble_mask = _mm_set1_epi8((char)0xf0);
+    const __m128i all_invalid = _mm_set1_epi8(-1);
+    Py_ssize_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i chars = _mm_loadu_si128((const __m128i *)(sequence + i));
+        __m128i low = _mm_and_si128(chars, low_nibble_mask);
+        __m128i high = _mm_and_si128(chars, high_nibble_mask);
+        __m128i in_4x = _mm_cmpeq_epi8(high, _mm_set1_epi8(0x40));
+        __m128i in_5x = _mm_cmpeq_epi8(high, _mm_set1_epi8(0x50));
+        __m128i code = _mm_or_si128(
+            _mm_and_si128(_mm_shuffle_epi8(codes_4x, low), in_4x),
+            _mm_and_si128(_mm_shuffle_epi8(codes_5x, low), in_5x));
+        // Characters outside both letter rows produce code 0, which is
+        // only correct for '='. Letters without a IUPAC meaning produce -1.
+        __m128i recognized = _mm_or_si128(
+            _mm_or_si128(in_4x, in_5x),
+            _mm_cmpeq_epi8(chars, _mm_set1_epi8('=')));
+        __m128i bad = _mm_or_si128(
+            _mm_cmpeq_epi8(code, all_invalid),
+            _mm_andnot_si128(recognized, all_invalid));
+        if (_mm_movemask_epi8(bad)) {
+            // Stop so the scalar loop can raise the precise error.
+            break;
+        }
+        // Pack the code pairs into bytes: the first nucleotide of each pair
+        // goes in the high nibble.
+        __m128i first = _mm_and_si128(_mm_slli_epi16(code, 4),
+                                      _mm_set1_epi16(0x00f0));
+        __m128i second = _mm_srli_epi16(code, 8);
+        _mm_storel_epi64(
+            (__m128i *)(encoded + i / 2),
+            _mm_packus_epi16(_mm_or_si128(first, second),
+                             _mm_setzero_si128()));
+    }
+    return i;
+}
+#endif
+
+// On platforms without a SIMD kernel all the work is left to the scalar
+// loop in BamRecord_set_sequence.
+static Py_ssize_t
+encode_nibbles_none(const uint8_t *Py_UNUSED(sequence),
+                    uint8_t *Py_UNUSED(encoded), Py_ssize_t Py_UNUSED(length))
+{
+    return 0;
+}
+
+// Resolved in the module init function. Returns the number of bases that
+// were encoded, always a multiple of 16.
+static Py_ssize_t (*encode_nibbles)(
+    const uint8_t *, uint8_t *, Py_ssize_t) = encode_nibbles_none;
+
 PyDoc_STRVAR(BamRecord_set_sequence__doc__,
 "Encode an ASCII-string containing IUPAC nucleotides and set it in the BAM record.");
 
@@ -958,10 +1482,11 @@ BamRecord_set_sequence(BamRecord *self, PyObject *const *args, Py_ssize_t nargs)
         Py_DECREF(new_qualities);
         return PyErr_NoMemory();
     }
-    Py_ssize_t i = 0;
-    Py_ssize_t j = 0;
     uint8_t * sequence_chars = (uint8_t *)PyUnicode_DATA(sequence);
     uint8_t * encoded_sequence_chars = (uint8_t *)PyBytes_AS_STRING(encoded_sequence);
+    Py_ssize_t i = encode_nibbles(sequence_chars, encoded_sequence_chars,
+                                  sequence_length);
+    Py_ssize_t j = i / 2;
     int8_t iupac_int_first;
     int8_t iupac_int_second;
     while (i < sequence_length) {
@@ -1000,64 +1525,241 @@ BamRecord_set_sequence(BamRecord *self, PyObject *const *args, Py_ssize_t nargs)
     Py_RETURN_NONE;
 }
 
-static inline int
-value_type_size(uint8_t value_type) {
-    switch(value_type) {
-        case 'A': 
-        case 'c': 
-        case 'C':
-            return 1;
-        case 's': 
-        case 'S':
-            return 2;
-        case 'f': 
-        case 'i': 
-        case 'I':
-            return 4; 
-        case 'd':
-            return 8;
-        default:
-            PyErr_Format(PyExc_ValueError, "Unkown value type: %c", value_type);
-            return 0;
+// The highest phred score that fits a FASTQ quality string: '~' - 33.
+#define PHRED_MAX 93
+// The ASCII offset between a phred score and its FASTQ character.
+#define PHRED_OFFSET 33
+
+static Py_ssize_t
+shift_bytes_range_checked_scalar(const uint8_t *src, uint8_t *dest,
+                                 Py_ssize_t length, uint8_t minimum,
+                                 uint8_t maximum, int8_t offset)
+{
+    for (Py_ssize_t i = 0; i < length; i += 1) {
+        if ((src[i] < minimum) || (src[i] > maximum)) {
+            return i;
+        }
+        dest[i] = src[i] + offset;
     }
+    return length;
 }
 
-static inline char *
-bam_array_type_to_python_type(uint8_t array_type){
-    switch (array_type) {
-        case 'c': return "b";
-        case 'C': return "B";
-        case 's': return "h";
-        case 'S': return "H";
-        case 'i': return "i";
-        case 'I': return "I";
-        case 'f': return "f";
-        case 'd': return "d";
-        default:
-            PyErr_Format(PyExc_ValueError, "Unknown array type: %c", array_type);
-            return NULL;
+#ifdef BUILD_SIMD_NIBBLE_DECODE
+__attribute__((target("sse2")))
+static Py_ssize_t
+shift_bytes_range_checked_sse2(const uint8_t *src, uint8_t *dest,
+                               Py_ssize_t length, uint8_t minimum,
+                               uint8_t maximum, int8_t offset)
+{
+    const __m128i min_vec = _mm_set1_epi8(minimum);
+    const __m128i max_vec = _mm_set1_epi8(maximum);
+    const __m128i offset_vec = _mm_set1_epi8(offset);
+    const __m128i zero = _mm_setzero_si128();
+    Py_ssize_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        // Saturating subtraction leaves a non-zero byte for every input
+        // byte outside [minimum, maximum]. This also catches the 0xFF
+        // "missing quality" sentinel.
+        __m128i out_of_range = _mm_or_si128(_mm_subs_epu8(in, max_vec),
+                                            _mm_subs_epu8(min_vec, in));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(out_of_range, zero)) != 0xffff) {
+            // Stop so the scalar loop can report the precise offender.
+            break;
+        }
+        _mm_storeu_si128((__m128i *)(dest + i), _mm_add_epi8(in, offset_vec));
     }
+    return i + shift_bytes_range_checked_scalar(src + i, dest + i, length - i,
+                                                minimum, maximum, offset);
 }
 
-static inline uint8_t
-python_array_type_to_bam_type(char *array_type){
-    uint8_t tp = array_type[0];
-    switch (tp) {
-        case 'b': return 'c';
-        case 'B': return 'C';
-        case 'h': return 's';
-        case 'H': return 'S';
-        case 'i': return 'i';
-        case 'I': return 'I';
-        case 'f': return 'f';
-        case 'd': return 'd';
-        default:
-            PyErr_Format(PyExc_ValueError, "Unknown array type: %s", array_type);
-            return 0;
+__attribute__((target("avx2")))
+static Py_ssize_t
+shift_bytes_range_checked_avx2(const uint8_t *src, uint8_t *dest,
+                               Py_ssize_t length, uint8_t minimum,
+                               uint8_t maximum, int8_t offset)
+{
+    const __m256i min_vec = _mm256_set1_epi8(minimum);
+    const __m256i max_vec = _mm256_set1_epi8(maximum);
+    const __m256i offset_vec = _mm256_set1_epi8(offset);
+    const __m256i zero = _mm256_setzero_si256();
+    Py_ssize_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i out_of_range = _mm256_or_si256(
+            _mm256_subs_epu8(in, max_vec), _mm256_subs_epu8(min_vec, in));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(out_of_range, zero)) !=
+                (int)0xffffffff) {
+            break;
+        }
+        _mm256_storeu_si256((__m256i *)(dest + i),
+                            _mm256_add_epi8(in, offset_vec));
     }
+    return i + shift_bytes_range_checked_scalar(src + i, dest + i, length - i,
+                                                minimum, maximum, offset);
 }
+#endif
 
-static const uint8_t * 
+// Resolved in the module init function. Copies src to dest with offset
+// added to every byte. Returns the index of the first byte outside
+// [minimum, maximum], or length when all bytes are in range.
+static Py_ssize_t (*shift_bytes_range_checked)(
+    const uint8_t *, uint8_t *, Py_ssize_t, uint8_t, uint8_t,
+    int8_t) = shift_bytes_range_checked_scalar;
+
+PyDoc_STRVAR(BamRecord_get_quality_string__doc__,
+"Convert the raw phred qualities to a FASTQ quality string.");
+
+#define BAMRECORD_GET_QUALITY_STRING_METHODDEF \
+    {"get_quality_string", \
+     (PyCFunction)(void(*)(void))BamRecord_get_quality_string, \
+     METH_NOARGS, BamRecord_get_quality_string__doc__}
+
+/**
+ * @brief Convert raw phred qualities to an ASCII string with the +33 offset.
+ *
+ * @param qualities The raw phred scores.
+ * @param length The number of scores (l_seq).
+ * @return PyObject* An ASCII str object or NULL on error.
+ */
+static PyObject *
+quality_string_from_ptr(const uint8_t *qualities, Py_ssize_t length)
+{
+    PyObject * retval = PyUnicode_New(length, 127);
+    if (retval == NULL) {
+        return PyErr_NoMemory();
+    }
+    uint8_t * quality_chars = (uint8_t *)PyUnicode_DATA(retval);
+    Py_ssize_t i = shift_bytes_range_checked(
+        qualities, quality_chars, length, 0, PHRED_MAX, PHRED_OFFSET);
+    if (i != length) {
+        if (qualities[i] == 0xff) {
+            PyErr_SetString(PyExc_ValueError,
+                "Record has no qualities (filled with the 0xFF sentinel)");
+        } else {
+            PyErr_Format(PyExc_ValueError,
+                "Phred quality %d at index %zd exceeds the maximum of %d",
+                qualities[i], i, PHRED_MAX);
+        }
+        Py_DECREF(retval);
+        return NULL;
+    }
+    return retval;
+}
+
+static PyObject *
+BamRecord_get_quality_string(BamRecord * self, PyObject * Py_UNUSED(ignore)) {
+    return quality_string_from_ptr((uint8_t *)PyBytes_AS_STRING(self->qual),
+                                   PyBytes_GET_SIZE(self->qual));
+}
+
+PyDoc_STRVAR(BamRecord_set_quality_string__doc__,
+"Decode a FASTQ quality string and set the raw phred qualities.");
+
+#define BAMRECORD_SET_QUALITY_STRING_METHODDEF \
+    {"set_quality_string", \
+     (PyCFunction)(void(*)(void))BamRecord_set_quality_string, \
+     METH_O, BamRecord_set_quality_string__doc__}
+
+static PyObject *
+BamRecord_set_quality_string(BamRecord *self, PyObject *quality_string) {
+    if (!PyUnicode_CheckExact(quality_string)) {
+        PyErr_Format(PyExc_TypeError,
+                     "quality_string must be of type str, got %s",
+                     Py_TYPE(quality_string)->tp_name);
+        return NULL;
+    }
+    if (!PyUnicode_IS_COMPACT_ASCII(quality_string)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "quality_string must only contain ASCII characters");
+        return NULL;
+    }
+    Py_ssize_t length = PyUnicode_GET_LENGTH(quality_string);
+    if ((uint32_t)length != self->l_seq) {
+        PyErr_SetString(PyExc_ValueError,
+            "quality_string and sequence must have the same length");
+        return NULL;
+    }
+    PyObject * new_qualities = PyBytes_FromStringAndSize(NULL, length);
+    if (new_qualities == NULL) {
+        return PyErr_NoMemory();
+    }
+    const uint8_t * quality_chars = (uint8_t *)PyUnicode_DATA(quality_string);
+    Py_ssize_t i = shift_bytes_range_checked(
+        quality_chars, (uint8_t *)PyBytes_AS_STRING(new_qualities), length,
+        PHRED_OFFSET, PHRED_OFFSET + PHRED_MAX, -PHRED_OFFSET);
+    if (i != length) {
+        PyErr_Format(PyExc_ValueError,
+            "Not a valid phred quality character: %c", quality_chars[i]);
+        Py_DECREF(new_qualities);
+        return NULL;
+    }
+    // The qualities have the same length as before, so block_size does not
+    // change.
+    PyObject * old_qualities = self->qual;
+    self->qual = new_qualities;
+    Py_DECREF(old_qualities);
+    Py_RETURN_NONE;
+}
+
+static inline int
+value_type_size(uint8_t value_type) {
+    switch(value_type) {
+        case 'A': 
+        case 'c': 
+        case 'C':
+            return 1;
+        case 's': 
+        case 'S':
+            return 2;
+        case 'f': 
+        case 'i': 
+        case 'I':
+            return 4; 
+        case 'd':
+            return 8;
+        default:
+            PyErr_Format(PyExc_ValueError, "Unkown value type: %c", value_type);
+            return 0;
+    }
+}
+
+static inline char *
+bam_array_type_to_python_type(uint8_t array_type){
+    switch (array_type) {
+        case 'c': return "b";
+        case 'C': return "B";
+        case 's': return "h";
+        case 'S': return "H";
+        case 'i': return "i";
+        case 'I': return "I";
+        case 'f': return "f";
+        case 'd': return "d";
+        default:
+            PyErr_Format(PyExc_ValueError, "Unknown array type: %c", array_type);
+            return NULL;
+    }
+}
+
+static inline uint8_t
+python_array_type_to_bam_type(char *array_type){
+    uint8_t tp = array_type[0];
+    switch (tp) {
+        case 'b': return 'c';
+        case 'B': return 'C';
+        case 'h': return 's';
+        case 'H': return 'S';
+        case 'i': return 'i';
+        case 'I': return 'I';
+        case 'f': return 'f';
+        case 'd': return 'd';
+        default:
+            PyErr_Format(PyExc_ValueError, "Unknown array type: %s", array_type);
+            return 0;
+    }
+}
+
+static const uint8_t * 
 skip_tag(const uint8_t *start, const uint8_t *end) {
     if (start >= end) {
         return end;
@@ -1270,10 +1972,10 @@ PyDoc_STRVAR(BamRecord_get_tag__doc__,
     {"get_tag", (PyCFunction)(void(*)(void))BamRecord_get_tag, METH_O, \
      BamRecord_get_tag__doc__}
 
-static PyObject * 
-BamRecord_get_tag(BamRecord *self, PyObject *tag) {
+static uint8_t *
+tag_argument_to_chars(PyObject *tag) {
     if (!PyUnicode_CheckExact(tag)) {
-        PyErr_Format(PyExc_TypeError, "tag must be of type str, got %s.", 
+        PyErr_Format(PyExc_TypeError, "tag must be of type str, got %s.",
                      Py_TYPE(tag)->tp_name);
         return NULL;
     }
@@ -1282,13 +1984,21 @@ BamRecord_get_tag(BamRecord *self, PyObject *tag) {
         return NULL;
     }
     if (!(PyUnicode_GET_LENGTH(tag) == 2)) {
-        PyErr_Format(PyExc_ValueError, "tag must have length 2, got %ld", 
+        PyErr_Format(PyExc_ValueError, "tag must have length 2, got %ld",
                                         PyUnicode_GET_LENGTH(tag));
         return NULL;
     }
-    uint8_t *search_tag = (uint8_t *)PyUnicode_DATA(tag);
-    uint8_t *tags = (uint8_t *)PyBytes_AS_STRING(self->tags);
-    Py_ssize_t tags_length = PyBytes_GET_SIZE(self->tags);
+    return (uint8_t *)PyUnicode_DATA(tag);
+}
+
+static PyObject *
+tags_object_get_tag(PyObject *tags_obj, PyObject *tag) {
+    uint8_t *search_tag = tag_argument_to_chars(tag);
+    if (search_tag == NULL) {
+        return NULL;
+    }
+    uint8_t *tags = (uint8_t *)PyBytes_AS_STRING(tags_obj);
+    Py_ssize_t tags_length = PyBytes_GET_SIZE(tags_obj);
     const uint8_t *found_tag = NULL;
     int ret = find_tag(tags, tags_length, search_tag, &found_tag);
     if (ret != 0) {
@@ -1298,7 +2008,127 @@ BamRecord_get_tag(BamRecord *self, PyObject *tag) {
         PyErr_Format(PyExc_KeyError, "Tag not found: %S", tag);
         return NULL;
     }
-    return tag_ptr_to_pyobject(found_tag, tags + tags_length, self->tags);
+    return tag_ptr_to_pyobject(found_tag, tags + tags_length, tags_obj);
+}
+
+/**
+ * @brief Build the tag key -> offset index for a record.
+ *
+ * A first pass over the tag bytes counts the tags so the index can be
+ * allocated at its exact size, the second fills it.
+ *
+ * @return int 0 on success, -1 on error with an exception set.
+ */
+static int
+BamRecord_build_tag_index(BamRecord *self) {
+    const uint8_t *tags = (uint8_t *)PyBytes_AS_STRING(self->tags);
+    const uint8_t *end = tags + PyBytes_GET_SIZE(self->tags);
+    const uint8_t *tag_ptr = tags;
+    Py_ssize_t number_of_tags = 0;
+    while (tag_ptr < end) {
+        tag_ptr = skip_tag(tag_ptr, end);
+        if (tag_ptr == NULL) {
+            return -1;
+        }
+        number_of_tags += 1;
+    }
+    BamTagIndexEntry *index = PyMem_Malloc(
+        number_of_tags * sizeof(BamTagIndexEntry));
+    if (index == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    tag_ptr = tags;
+    for (Py_ssize_t i = 0; i < number_of_tags; i += 1) {
+        index[i].key = (uint16_t)tag_ptr[0] << 8 | (uint16_t)tag_ptr[1];
+        index[i].offset = (uint32_t)(tag_ptr - tags);
+        // The first pass already validated all tags.
+        tag_ptr = skip_tag(tag_ptr, end);
+    }
+    self->tag_index = index;
+    self->tag_index_length = number_of_tags;
+    return 0;
+}
+
+static PyObject *
+BamRecord_get_tag(BamRecord *self, PyObject *tag) {
+    uint8_t *search_tag = tag_argument_to_chars(tag);
+    if (search_tag == NULL) {
+        return NULL;
+    }
+    if (self->tag_index == NULL) {
+        if (BamRecord_build_tag_index(self) != 0) {
+            return NULL;
+        }
+    }
+    uint16_t key = (uint16_t)search_tag[0] << 8 | (uint16_t)search_tag[1];
+    const uint8_t *tags = (uint8_t *)PyBytes_AS_STRING(self->tags);
+    const uint8_t *end = tags + PyBytes_GET_SIZE(self->tags);
+    for (Py_ssize_t i = 0; i < self->tag_index_length; i += 1) {
+        if (self->tag_index[i].key == key) {
+            return tag_ptr_to_pyobject(tags + self->tag_index[i].offset,
+                                       end, self->tags);
+        }
+    }
+    PyErr_Format(PyExc_KeyError, "Tag not found: %S", tag);
+    return NULL;
+}
+
+PyDoc_STRVAR(BamRecord_get_tags_dict__doc__,
+"get_tags_dict($self, /)\n"
+"--\n"
+"\n"
+"Decode all tags in a single pass and return them as a dict mapping\n"
+"two-letter tag names to their values.\n");
+
+#define BAMRECORD_GET_TAGS_DICT_METHODDEF    \
+    {"get_tags_dict", (PyCFunction)(void(*)(void))BamRecord_get_tags_dict, \
+     METH_NOARGS, BamRecord_get_tags_dict__doc__}
+
+static PyObject *
+tags_object_to_dict(PyObject *tags_obj) {
+    const uint8_t *tags = (uint8_t *)PyBytes_AS_STRING(tags_obj);
+    const uint8_t *end = tags + PyBytes_GET_SIZE(tags_obj);
+    PyObject *retval = PyDict_New();
+    if (retval == NULL) {
+        return NULL;
+    }
+    const uint8_t *tag_ptr = tags;
+    while (tag_ptr < end) {
+        if (tag_ptr + 2 >= end) {
+            PyErr_SetString(PyExc_ValueError, "truncated tag");
+            goto error;
+        }
+        PyObject *key = PyUnicode_New(2, 127);
+        if (key == NULL) {
+            goto error;
+        }
+        memcpy(PyUnicode_DATA(key), tag_ptr, 2);
+        PyObject *value = tag_ptr_to_pyobject(tag_ptr, end, tags_obj);
+        if (value == NULL) {
+            Py_DECREF(key);
+            goto error;
+        }
+        int ret = PyDict_SetItem(retval, key, value);
+        Py_DECREF(key);
+        Py_DECREF(value);
+        if (ret != 0) {
+            goto error;
+        }
+        tag_ptr = skip_tag(tag_ptr, end);
+        if (tag_ptr == NULL) {
+            goto error;
+        }
+    }
+    return retval;
+error:
+    Py_DECREF(retval);
+    return NULL;
+}
+
+static PyObject *
+BamRecord_get_tags_dict(BamRecord *self, PyObject *Py_UNUSED(ignore)) {
+    return tags_object_to_dict(self->tags);
 }
 
 static const char *tag_to_value_type(const uint8_t *tag) {
@@ -1465,41 +2295,74 @@ static int _BamRecord_replace_tag(BamRecord *self,
     self->tags = tmp;
     self->block_size = new_block_size;
     Py_DECREF(old_tag_object);
+    BamRecord_invalidate_tag_index(self);
     return 0;
 }
 
-static int _BamRecord_set_array_tag(BamRecord *self,
-                                    const uint8_t *tag,
-                                    uint8_t array_type, 
-                                    PyObject *value)
-{
+/**
+ * @brief A serialized tag mutation that has not been spliced into the tag
+ *        buffer yet.
+ *
+ * tag_marker holds the tag, value_type and, for B tags, the array type and
+ * count. tag_value points into tag_value_store for numeric values, into the
+ * string object for A/Z values or into the acquired buffer for B values, so
+ * the value object must stay alive until _BamTagUpdate_release is called.
+ * A marker and value length of 0 means the tag is deleted.
+ */
+typedef struct {
+    uint8_t tag[2];
+    uint8_t tag_marker[8];
+    size_t tag_marker_length;
+    uint8_t tag_value_store[8];
+    const uint8_t *tag_value;
+    size_t tag_value_length;
     Py_buffer buffer;
+    int buffer_acquired;
+    // Set by set_tags once the first occurrence in the buffer is found.
+    int matched;
+} BamTagUpdate;
+
+static void _BamTagUpdate_release(BamTagUpdate *update)
+{
+    if (update->buffer_acquired) {
+        PyBuffer_Release(&update->buffer);
+        update->buffer_acquired = 0;
+    }
+}
+
+static int _BamTagUpdate_serialize_array(BamTagUpdate *update,
+                                         const uint8_t *tag,
+                                         uint8_t array_type,
+                                         PyObject *value)
+{
+    Py_buffer *buffer = &update->buffer;
     uint8_t tp = array_type;
     if (tp) {
-        if (PyObject_GetBuffer(value, &buffer, PyBUF_SIMPLE) != 0) {
+        if (PyObject_GetBuffer(value, buffer, PyBUF_SIMPLE) != 0) {
             return -1;
         }
     }
     else {
-        if (PyObject_GetBuffer(value, &buffer, PyBUF_FORMAT) != 0) {
+        if (PyObject_GetBuffer(value, buffer, PyBUF_FORMAT) != 0) {
             return -1;
         }
-        tp = python_array_type_to_bam_type(buffer.format);
+        tp = python_array_type_to_bam_type(buffer->format);
         if (tp == 0) {  // Extremely unlikely. Unless python changes its formats.
             goto error;
         }
     }
+    update->buffer_acquired = 1;
     int itemsize = value_type_size(tp);
-    if (buffer.len % itemsize) {
+    if (buffer->len % itemsize) {
         PyErr_Format(
-            PyExc_ValueError, 
-            "Cannot set tag '%c%c' with type 'B%c' using %R. " 
+            PyExc_ValueError,
+            "Cannot set tag '%c%c' with type 'B%c' using %R. "
             "Buffer size not a multiple of %d.",
             tag[0], tag[1], tp, value, itemsize
         );
         goto error;
     }
-    size_t array_size = buffer.len / itemsize;
+    size_t array_size = buffer->len / itemsize;
     if (array_size > UINT32_MAX) {
         PyErr_Format(
             PyExc_OverflowError,
@@ -1507,26 +2370,30 @@ static int _BamRecord_set_array_tag(BamRecord *self,
         );
         goto error;
     }
-    uint8_t tag_marker[8] = {tag[0], tag[1], 'B', tp, 0, 0, 0, 0};
-    ((uint32_t *)tag_marker)[1] = (uint32_t)array_size;
-    int ret = _BamRecord_replace_tag(self, tag, tag_marker, 8, buffer.buf, buffer.len);
-    PyBuffer_Release(&buffer);
-    return ret;
+    update->tag_marker[0] = tag[0];
+    update->tag_marker[1] = tag[1];
+    update->tag_marker[2] = 'B';
+    update->tag_marker[3] = tp;
+    ((uint32_t *)update->tag_marker)[1] = (uint32_t)array_size;
+    update->tag_marker_length = 8;
+    update->tag_value = buffer->buf;
+    update->tag_value_length = buffer->len;
+    return 0;
 error:
-    PyBuffer_Release(&buffer);
+    _BamTagUpdate_release(update);
     return -1;
 }
 
-static int _BamRecord_set_tag(BamRecord *self, 
-                              const uint8_t *tag, 
-                              const uint8_t *value_type, 
-                              PyObject *value) 
+static int _BamTagUpdate_serialize(BamTagUpdate *update,
+                                   const uint8_t *tag,
+                                   const uint8_t *value_type,
+                                   PyObject *value)
 {
-    uint8_t tag_value_store[8];
-    void *tag_value = tag_value_store;
+    const uint8_t *tag_value = update->tag_value_store;
     size_t tag_value_size = 0;
     double dbl;
 
+    update->buffer_acquired = 0;
     switch(value_type[0]) {
         default:
             PyErr_Format(PyExc_ValueError, "Unkown format: %c", value_type[0]);
@@ -1534,8 +2401,8 @@ static int _BamRecord_set_tag(BamRecord *self,
         case 'B':
             // Array tags are quite different and thus require quite a different
             // approach than single value tags and strings.
-            return _BamRecord_set_array_tag(self, tag, value_type[1], value);
-        case 'A': 
+            return _BamTagUpdate_serialize_array(update, tag, value_type[1], value);
+        case 'A':
         case 'Z':
             if (!PyUnicode_CheckExact(value)) {
                 PyErr_Format(
@@ -1573,37 +2440,60 @@ static int _BamRecord_set_tag(BamRecord *self,
             }
             break;
         case 'c':
-            tag_value_size = StorePyObjectValue_c(value, tag_value_store, tag);
+            tag_value_size = StorePyObjectValue_c(value, update->tag_value_store, tag);
             break;
         case 'C':
-            tag_value_size = StorePyObjectValue_C(value, tag_value_store, tag);
+            tag_value_size = StorePyObjectValue_C(value, update->tag_value_store, tag);
             break;
         case 's':
-            tag_value_size = StorePyObjectValue_s(value, tag_value_store, tag);
+            tag_value_size = StorePyObjectValue_s(value, update->tag_value_store, tag);
             break;
         case 'S':
-            tag_value_size = StorePyObjectValue_S(value, tag_value_store, tag);
+            tag_value_size = StorePyObjectValue_S(value, update->tag_value_store, tag);
             break;
         case 'i':
-            tag_value_size = StorePyObjectValue_i(value, tag_value_store, tag);
+            tag_value_size = StorePyObjectValue_i(value, update->tag_value_store, tag);
             break;
         case 'I':
-            tag_value_size = StorePyObjectValue_I(value, tag_value_store, tag);
+            tag_value_size = StorePyObjectValue_I(value, update->tag_value_store, tag);
             break;
         case 'f':
             dbl = PyFloat_AsDouble(value);
             if ((dbl == -1.0L) && PyErr_Occurred()) {
                 return -1;
             }
-            ((float *)tag_value_store)[0] = (float)dbl;
+            ((float *)update->tag_value_store)[0] = (float)dbl;
             tag_value_size = 4;
             break;
     }
     if (tag_value_size == 0) {
         return -1;
     }
-    uint8_t tag_marker[3] = {tag[0], tag[1], value_type[0]};
-    return _BamRecord_replace_tag(self, tag, tag_marker, 3, tag_value, tag_value_size);
+    update->tag_marker[0] = tag[0];
+    update->tag_marker[1] = tag[1];
+    update->tag_marker[2] = value_type[0];
+    update->tag_marker_length = 3;
+    update->tag_value = tag_value;
+    update->tag_value_length = tag_value_size;
+    return 0;
+}
+
+static int _BamRecord_set_tag(BamRecord *self,
+                              const uint8_t *tag,
+                              const uint8_t *value_type,
+                              PyObject *value)
+{
+    BamTagUpdate update = {.buffer_acquired = 0};
+    if (_BamTagUpdate_serialize(&update, tag, value_type, value) != 0) {
+        return -1;
+    }
+    int ret = _BamRecord_replace_tag(self, tag,
+                                     update.tag_marker,
+                                     update.tag_marker_length,
+                                     (uint8_t *)update.tag_value,
+                                     update.tag_value_length);
+    _BamTagUpdate_release(&update);
+    return ret;
 }
 
 PyDoc_STRVAR(BamRecord_set_tag__doc__,
@@ -1696,331 +2586,2836 @@ static PyObject *BamRecord_set_tag(BamRecord *self, PyObject *args, PyObject *kw
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(BamRecord_set_tags_batch__doc__,
+"set_tags($self, tags, /)\n"
+"--\n"
+"\n"
+"Set the value of multiple tags in one pass over the tag buffer.\n"
+"\n"
+"  tags\n"
+"    A dict mapping two-letter ASCII tag strings to values. Using None\n"
+"    as a value deletes the tag. Value types are determined the same\n"
+"    way as in set_tag.\n"
+"\n"
+"The new tag buffer is built with a single allocation and copy, where\n"
+"calling set_tag repeatedly copies the entire buffer for every call.\n");
 
-static void
-BamRecord_to_ptr(BamRecord *self, char * dest) {
-    memcpy(dest, (char *)self + BAM_PROPERTIES_STRUCT_START,
-         BAM_PROPERTIES_STRUCT_SIZE);
-    Py_ssize_t cursor = BAM_PROPERTIES_STRUCT_SIZE;
-    
-    Py_ssize_t read_name_size = PyBytes_GET_SIZE(self->read_name);
-    memcpy(dest + cursor, PyBytes_AS_STRING(self->read_name), read_name_size);
-    cursor += read_name_size;
-
-    // Terminate read_name with NULL byte
-    dest[cursor] = 0; cursor += 1;
-
-    Py_ssize_t cigar_char_size = Py_SIZE(self->bamcigar) * sizeof(uint32_t);
-    memcpy(dest + cursor, BamCigar_GET_CIGAR(self->bamcigar), cigar_char_size);
-    cursor += cigar_char_size;
-
-    Py_ssize_t seq_size = PyBytes_GET_SIZE(self->seq);
-    memcpy(dest + cursor, PyBytes_AS_STRING(self->seq), seq_size);
-    cursor += seq_size;
-
-    Py_ssize_t qual_size = PyBytes_GET_SIZE(self->qual);
-    memcpy(dest + cursor, PyBytes_AS_STRING(self->qual), qual_size);
-    cursor += qual_size;
-
-    Py_ssize_t tag_size = PyBytes_GET_SIZE(self->tags);
-    memcpy(dest + cursor, PyBytes_AS_STRING(self->tags), tag_size);
-}
-
-
-PyDoc_STRVAR(BamRecord_to_bytes__doc__,
-"Return the BAM record as a bytesobject that can be written into a file.");
-
-#define BAMRECORD_TO_BYTES_METHODDEF    \
-    {"to_bytes", (PyCFunction)(void(*)(void))BamRecord_to_bytes, METH_NOARGS, \
-     BamRecord_to_bytes__doc__}
+#define BAMRECORD_SET_TAGS_METHODDEF    \
+    {"set_tags", (PyCFunction)(void(*)(void))BamRecord_set_tags_batch, \
+     METH_O, BamRecord_set_tags_batch__doc__}
 
 static PyObject *
-BamRecord_to_bytes(BamRecord *self, PyObject *NoArgs)
+BamRecord_set_tags_batch(BamRecord *self, PyObject *tags_dict)
 {
-    PyObject * ret_val = PyBytes_FromStringAndSize(
-        NULL, self->block_size + sizeof(self->block_size));
-    if (ret_val == NULL){
-        return PyErr_NoMemory();
+    if (!PyDict_CheckExact(tags_dict)) {
+        PyErr_Format(PyExc_TypeError, "tags must be of type dict, got %s.",
+                     Py_TYPE(tags_dict)->tp_name);
+        return NULL;
+    }
+    Py_ssize_t number_of_updates = PyDict_GET_SIZE(tags_dict);
+    if (number_of_updates == 0) {
+        Py_RETURN_NONE;
+    }
+    BamTagUpdate *updates = PyMem_Calloc(number_of_updates,
+                                         sizeof(BamTagUpdate));
+    // The start and length of each removed tag, in buffer order.
+    const uint8_t **removed_starts = PyMem_Malloc(
+        number_of_updates * sizeof(const uint8_t *));
+    size_t *removed_lengths = PyMem_Malloc(
+        number_of_updates * sizeof(size_t));
+    if ((updates == NULL) || (removed_starts == NULL) ||
+        (removed_lengths == NULL)) {
+        PyErr_NoMemory();
+        goto error;
     }
-    char * bam_bytes = PyBytes_AS_STRING(ret_val);
-    BamRecord_to_ptr(self, bam_bytes);
-    return ret_val;
-}
-
 
-static PyMethodDef BamRecord_methods[] = {
-    BAMRECORD_TO_BYTES_METHODDEF,
-    BAMRECORD_GET_SEQUENCE_METHODDEF,
-    BAMRECORD_SET_SEQUENCE_METHODDEF,
+    PyObject *key = NULL;
+    PyObject *value = NULL;
+    Py_ssize_t dict_pos = 0;
+    Py_ssize_t i = 0;
+    while (PyDict_Next(tags_dict, &dict_pos, &key, &value)) {
+        uint8_t *tag = tag_argument_to_chars(key);
+        if (tag == NULL) {
+            goto error;
+        }
+        BamTagUpdate *update = updates + i;
+        update->tag[0] = tag[0];
+        update->tag[1] = tag[1];
+        if (value != Py_None) {
+            const uint8_t *value_type = (uint8_t *)tag_to_value_type(tag);
+            if (value_type == NULL) {
+                value_type = (uint8_t *)PyObject_to_value_type(value);
+            }
+            if (value_type == NULL) {
+                goto error;
+            }
+            if (_BamTagUpdate_serialize(update, tag, value_type, value) != 0) {
+                goto error;
+            }
+        }
+        // A None value leaves the marker and value lengths at 0: deletion.
+        i += 1;
+    }
+
+    // One pass over the tag buffer resolves all replace and delete
+    // positions. Only the first occurrence of each tag is removed, the
+    // same as repeated set_tag calls.
+    const uint8_t *tags = (uint8_t *)PyBytes_AS_STRING(self->tags);
+    Py_ssize_t tags_length = PyBytes_GET_SIZE(self->tags);
+    const uint8_t *tags_end = tags + tags_length;
+    const uint8_t *tag_ptr = tags;
+    size_t removed_length = 0;
+    Py_ssize_t number_removed = 0;
+    while (tag_ptr < tags_end) {
+        if (tag_ptr + 2 >= tags_end) {
+            PyErr_SetString(PyExc_ValueError, "truncated tag");
+            goto error;
+        }
+        const uint8_t *next_tag_ptr = skip_tag(tag_ptr, tags_end);
+        if (next_tag_ptr == NULL) {
+            goto error;
+        }
+        for (i = 0; i < number_of_updates; i++) {
+            BamTagUpdate *update = updates + i;
+            if (update->matched ||
+                (update->tag[0] != tag_ptr[0]) ||
+                (update->tag[1] != tag_ptr[1])) {
+                continue;
+            }
+            update->matched = 1;
+            removed_starts[number_removed] = tag_ptr;
+            removed_lengths[number_removed] = next_tag_ptr - tag_ptr;
+            removed_length += next_tag_ptr - tag_ptr;
+            number_removed += 1;
+            break;
+        }
+        tag_ptr = next_tag_ptr;
+    }
+
+    size_t added_length = 0;
+    for (i = 0; i < number_of_updates; i++) {
+        added_length += updates[i].tag_marker_length +
+                        updates[i].tag_value_length;
+    }
+    Py_ssize_t new_size = tags_length - removed_length + added_length;
+    size_t new_block_size = self->block_size + new_size - tags_length;
+    if (new_block_size > UINT32_MAX) {
+        PyErr_SetString(PyExc_OverflowError,
+                        "Value too big to store in BamRecord");
+        goto error;
+    }
+    PyObject *tmp = PyBytes_FromStringAndSize(NULL, new_size);
+    if (tmp == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    // Copy the surviving stretches of the old buffer, then append the new
+    // tags in dict order, the same position a replaced tag ends up in
+    // after set_tag.
+    uint8_t *new_tags = (uint8_t *)PyBytes_AS_STRING(tmp);
+    const uint8_t *copy_from = tags;
+    for (i = 0; i < number_removed; i++) {
+        size_t stretch = removed_starts[i] - copy_from;
+        memcpy(new_tags, copy_from, stretch);
+        new_tags += stretch;
+        copy_from = removed_starts[i] + removed_lengths[i];
+    }
+    memcpy(new_tags, copy_from, tags_end - copy_from);
+    new_tags += tags_end - copy_from;
+    for (i = 0; i < number_of_updates; i++) {
+        memcpy(new_tags, updates[i].tag_marker, updates[i].tag_marker_length);
+        new_tags += updates[i].tag_marker_length;
+        memcpy(new_tags, updates[i].tag_value, updates[i].tag_value_length);
+        new_tags += updates[i].tag_value_length;
+    }
+    PyObject *old_tag_object = self->tags;
+    self->tags = tmp;
+    self->block_size = new_block_size;
+    Py_DECREF(old_tag_object);
+    BamRecord_invalidate_tag_index(self);
+    for (i = 0; i < number_of_updates; i++) {
+        _BamTagUpdate_release(updates + i);
+    }
+    PyMem_Free(updates);
+    PyMem_Free(removed_starts);
+    PyMem_Free(removed_lengths);
+    Py_RETURN_NONE;
+error:
+    if (updates != NULL) {
+        for (i = 0; i < number_of_updates; i++) {
+            _BamTagUpdate_release(updates + i);
+        }
+    }
+    PyMem_Free(updates);
+    PyMem_Free(removed_starts);
+    PyMem_Free(removed_lengths);
+    return NULL;
+}
+
+
+static void
+BamRecord_to_ptr(BamRecord *self, char * dest) {
+    memcpy(dest, (char *)self + BAM_PROPERTIES_STRUCT_START,
+         BAM_PROPERTIES_STRUCT_SIZE);
+    Py_ssize_t cursor = BAM_PROPERTIES_STRUCT_SIZE;
+    
+    Py_ssize_t read_name_size = PyBytes_GET_SIZE(self->read_name);
+    memcpy(dest + cursor, PyBytes_AS_STRING(self->read_name), read_name_size);
+    cursor += read_name_size;
+
+    // Terminate read_name with NULL byte
+    dest[cursor] = 0; cursor += 1;
+
+    Py_ssize_t cigar_char_size = Py_SIZE(self->bamcigar) * sizeof(uint32_t);
+    memcpy(dest + cursor, BamCigar_GET_CIGAR(self->bamcigar), cigar_char_size);
+    cursor += cigar_char_size;
+
+    Py_ssize_t seq_size = PyBytes_GET_SIZE(self->seq);
+    memcpy(dest + cursor, PyBytes_AS_STRING(self->seq), seq_size);
+    cursor += seq_size;
+
+    Py_ssize_t qual_size = PyBytes_GET_SIZE(self->qual);
+    memcpy(dest + cursor, PyBytes_AS_STRING(self->qual), qual_size);
+    cursor += qual_size;
+
+    Py_ssize_t tag_size = PyBytes_GET_SIZE(self->tags);
+    memcpy(dest + cursor, PyBytes_AS_STRING(self->tags), tag_size);
+}
+
+
+PyDoc_STRVAR(BamRecord_to_bytes__doc__,
+"Return the BAM record as a bytesobject that can be written into a file.");
+
+#define BAMRECORD_TO_BYTES_METHODDEF    \
+    {"to_bytes", (PyCFunction)(void(*)(void))BamRecord_to_bytes, METH_NOARGS, \
+     BamRecord_to_bytes__doc__}
+
+static PyObject *
+BamRecord_to_bytes(BamRecord *self, PyObject *NoArgs)
+{
+    PyObject * ret_val = PyBytes_FromStringAndSize(
+        NULL, self->block_size + sizeof(self->block_size));
+    if (ret_val == NULL){
+        return PyErr_NoMemory();
+    }
+    char * bam_bytes = PyBytes_AS_STRING(ret_val);
+    BamRecord_to_ptr(self, bam_bytes);
+    return ret_val;
+}
+
+PyDoc_STRVAR(BamRecord_from_bytes__doc__,
+"from_bytes($type, data, /)\n"
+"--\n"
+"\n"
+"Construct a BamRecord from the bytes representation of exactly one\n"
+"record, as stored in a BAM file and returned by to_bytes().\n"
+"\n"
+"  data\n"
+"    The raw record, starting at the block_size field. May be any object\n"
+"    that supports the buffer protocol: bytes, bytearray, memoryview.\n"
+"\n");
+
+#define BAMRECORD_FROM_BYTES_METHODDEF    \
+    {"from_bytes", (PyCFunction)(void(*)(void))BamRecord_from_bytes, \
+     METH_O | METH_CLASS, BamRecord_from_bytes__doc__}
+
+static PyObject *
+BamRecord_from_bytes(PyTypeObject *cls, PyObject *data)
+{
+    Py_buffer view;
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) != 0) {
+        return NULL;
+    }
+    const char *buf = view.buf;
+    Py_ssize_t len = view.len;
+    if (len < BAM_PROPERTIES_STRUCT_SIZE) {
+        PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    BamRecord *bam_record = BamRecord_New();
+    if (bam_record == NULL) {
+        PyBuffer_Release(&view);
+        return PyErr_NoMemory();
+    }
+    // Copy the bam file data directly into the struct, the same way
+    // BamIterator does.
+    memcpy((char *)bam_record + BAM_PROPERTIES_STRUCT_START, buf,
+           BAM_PROPERTIES_STRUCT_SIZE);
+    bam_record->read_name = NULL;
+    bam_record->bamcigar = NULL;
+    bam_record->seq = NULL;
+    bam_record->qual = NULL;
+    bam_record->tags = NULL;
+    Py_ssize_t record_length = bam_record->block_size + 4;
+    Py_ssize_t cigar_length = bam_record->n_cigar_op * sizeof(uint32_t);
+    Py_ssize_t seq_length = (bam_record->l_seq + 1) / 2;
+    Py_ssize_t tags_offset = BAM_PROPERTIES_STRUCT_SIZE +
+                             bam_record->l_read_name + cigar_length +
+                             seq_length + bam_record->l_seq;
+    if (bam_record->l_read_name == 0) {
+        PyErr_SetString(PyExc_ValueError,
+            "Invalid BAM record: l_read_name is 0");
+        goto error;
+    }
+    if ((record_length > len) || (tags_offset > record_length)) {
+        PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+        goto error;
+    }
+    if (record_length < len) {
+        PyErr_Format(PyExc_ValueError,
+            "data contains %zd trailing bytes after the record",
+            len - record_length);
+        goto error;
+    }
+    Py_ssize_t cursor = BAM_PROPERTIES_STRUCT_SIZE;
+    bam_record->read_name = PyBytes_FromStringAndSize(
+        buf + cursor, bam_record->l_read_name - 1);
+    cursor += bam_record->l_read_name;
+    bam_record->bamcigar = BamCigar_FromPointerAndSize(
+        (uint32_t *)(buf + cursor), bam_record->n_cigar_op);
+    cursor += cigar_length;
+    bam_record->seq = PyBytes_FromStringAndSize(buf + cursor, seq_length);
+    cursor += seq_length;
+    bam_record->qual = PyBytes_FromStringAndSize(
+        buf + cursor, bam_record->l_seq);
+    cursor += bam_record->l_seq;
+    bam_record->tags = PyBytes_FromStringAndSize(
+        buf + cursor, record_length - cursor);
+    if ((bam_record->read_name == NULL) || (bam_record->bamcigar == NULL) ||
+        (bam_record->seq == NULL) || (bam_record->qual == NULL) ||
+        (bam_record->tags == NULL)) {
+        Py_DECREF(bam_record);
+        PyBuffer_Release(&view);
+        return PyErr_NoMemory();
+    }
+    PyBuffer_Release(&view);
+    return (PyObject *)bam_record;
+error:
+    Py_DECREF(bam_record);
+    PyBuffer_Release(&view);
+    return NULL;
+}
+
+PyDoc_STRVAR(BamRecord___reduce____doc__,
+"Helper for pickle: the record crosses process boundaries as the single\n"
+"compact bytes object from to_bytes(), rebuilt with from_bytes(),\n"
+"instead of five separately pickled member objects.");
+
+#define BAMRECORD___REDUCE___METHODDEF    \
+    {"__reduce__", (PyCFunction)(void(*)(void))BamRecord___reduce__, \
+     METH_NOARGS, BamRecord___reduce____doc__}
+
+static PyObject *
+BamRecord___reduce__(BamRecord *self, PyObject *Py_UNUSED(ignore))
+{
+    PyObject *from_bytes = PyObject_GetAttrString(
+        (PyObject *)Py_TYPE(self), "from_bytes");
+    if (from_bytes == NULL) {
+        return NULL;
+    }
+    PyObject *record_bytes = BamRecord_to_bytes(self, NULL);
+    if (record_bytes == NULL) {
+        Py_DECREF(from_bytes);
+        return NULL;
+    }
+    return Py_BuildValue("N(N)", from_bytes, record_bytes);
+}
+
+// A resolved reference name for the SAM RNAME and RNEXT columns. The name
+// pointer borrows the storage of a str object.
+typedef struct {
+    const char *name;
+    Py_ssize_t length;
+} SamReference;
+
+/**
+ * @brief Resolve a fast sequence of reference name strings into an array
+ *        of (pointer, length) pairs. The pointers borrow the string
+ *        storage, so the sequence must stay alive while the array is in
+ *        use.
+ *
+ * @param sequence a PySequence_Fast object containing str objects.
+ * @return SamReference* an array to free with PyMem_Free, or NULL with an
+ *         error set.
+ */
+static SamReference *
+sam_references_resolve(PyObject *sequence)
+{
+    Py_ssize_t number_of_references = PySequence_Fast_GET_SIZE(sequence);
+    SamReference *references = PyMem_Malloc(
+        number_of_references * sizeof(SamReference));
+    if (references == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    for (Py_ssize_t i = 0; i < number_of_references; i += 1) {
+        PyObject *item = PySequence_Fast_GET_ITEM(sequence, i);
+        if (!PyUnicode_CheckExact(item)) {
+            PyErr_Format(PyExc_TypeError,
+                         "reference names must be of type str, got %s.",
+                         Py_TYPE(item)->tp_name);
+            PyMem_Free(references);
+            return NULL;
+        }
+        if (!PyUnicode_IS_COMPACT_ASCII(item)) {
+            PyErr_SetString(PyExc_ValueError,
+                "reference name contains non-ASCII characters");
+            PyMem_Free(references);
+            return NULL;
+        }
+        references[i].name = (const char *)PyUnicode_1BYTE_DATA(item);
+        references[i].length = PyUnicode_GET_LENGTH(item);
+    }
+    return references;
+}
+
+/**
+ * @brief Write a float tag value with 'g' formatting, independent of the
+ *        locale. Needs at most 24 characters of buffer space.
+ *
+ * @return char* the new cursor position or NULL with an error set.
+ */
+static char *
+sam_format_double(double value, char *cursor)
+{
+    char *formatted = PyOS_double_to_string(value, 'g', 6, 0, NULL);
+    if (formatted == NULL) {
+        return NULL;
+    }
+    size_t length = strlen(formatted);
+    memcpy(cursor, formatted, length);
+    PyMem_Free(formatted);
+    return cursor + length;
+}
+
+/**
+ * @brief Write one numeric tag value or array element in SAM text form.
+ *        Needs at most 24 characters of buffer space.
+ *
+ * @param value_type the BAM value type character.
+ * @param value pointer to the raw little-endian value.
+ * @return char* the new cursor position or NULL with an error set.
+ */
+static char *
+sam_format_tag_element(uint8_t value_type, const uint8_t *value, char *cursor)
+{
+    switch (value_type) {
+        case 'c': {
+            int8_t c_value;
+            memcpy(&c_value, value, sizeof(c_value));
+            return cursor + format_int32(c_value, cursor);
+        }
+        case 'C':
+            return cursor + format_uint32(value[0], cursor);
+        case 's': {
+            int16_t s_value;
+            memcpy(&s_value, value, sizeof(s_value));
+            return cursor + format_int32(s_value, cursor);
+        }
+        case 'S': {
+            uint16_t S_value;
+            memcpy(&S_value, value, sizeof(S_value));
+            return cursor + format_uint32(S_value, cursor);
+        }
+        case 'i': {
+            int32_t i_value;
+            memcpy(&i_value, value, sizeof(i_value));
+            return cursor + format_int32(i_value, cursor);
+        }
+        case 'I': {
+            uint32_t I_value;
+            memcpy(&I_value, value, sizeof(I_value));
+            return cursor + format_uint32(I_value, cursor);
+        }
+        case 'f': {
+            float f_value;
+            memcpy(&f_value, value, sizeof(f_value));
+            return sam_format_double(f_value, cursor);
+        }
+        case 'd': {
+            double d_value;
+            memcpy(&d_value, value, sizeof(d_value));
+            return sam_format_double(d_value, cursor);
+        }
+        default:
+            PyErr_Format(PyExc_ValueError, "Unkown value type: %c",
+                         value_type);
+            return NULL;
+    }
+}
+
+/**
+ * @brief Write one tag value as '%c:value' SAM text. The tag must already
+ *        have been validated by skip_tag.
+ *
+ * @param tag_ptr pointer to the start of the tag.
+ * @param next_tag pointer to the start of the next tag, as returned by
+ *        skip_tag.
+ * @return char* the new cursor position or NULL with an error set.
+ */
+static char *
+sam_format_tag_value(const uint8_t *tag_ptr, const uint8_t *next_tag,
+                     char *cursor)
+{
+    uint8_t value_type = tag_ptr[2];
+    const uint8_t *value = tag_ptr + 3;
+    switch (value_type) {
+        case 'A':
+            cursor[0] = 'A';
+            cursor[1] = ':';
+            cursor[2] = value[0];
+            return cursor + 3;
+        case 'Z':
+        case 'H': {
+            cursor[0] = value_type;
+            cursor[1] = ':';
+            cursor += 2;
+            // Minus the terminating NULL byte.
+            Py_ssize_t length = (next_tag - value) - 1;
+            memcpy(cursor, value, length);
+            return cursor + length;
+        }
+        case 'B': {
+            uint8_t array_type = tag_ptr[3];
+            int itemsize = value_type_size(array_type);
+            if (itemsize == 0) {
+                return NULL;
+            }
+            uint32_t array_length;
+            memcpy(&array_length, tag_ptr + 4, sizeof(array_length));
+            cursor[0] = 'B';
+            cursor[1] = ':';
+            cursor[2] = array_type;
+            cursor += 3;
+            const uint8_t *element = tag_ptr + 8;
+            for (uint32_t i = 0; i < array_length; i += 1) {
+                *cursor = ','; cursor += 1;
+                cursor = sam_format_tag_element(array_type, element, cursor);
+                if (cursor == NULL) {
+                    return NULL;
+                }
+                element += itemsize;
+            }
+            return cursor;
+        }
+        default:
+            // SAM text has a single integer type 'i' for all the sized
+            // BAM integer types, and no double type, so 'd' is emitted
+            // as 'f'.
+            cursor[0] = (value_type == 'f' || value_type == 'd') ? 'f' : 'i';
+            cursor[1] = ':';
+            return sam_format_tag_element(value_type, value, cursor + 2);
+    }
+}
+
+/**
+ * @brief Compute an upper bound for the number of characters the SAM
+ *        representation of a raw BAM record can take, validating the
+ *        record layout and the reference IDs in the process.
+ *
+ * @param record pointer to the record, starting at the block_size field.
+ * @param record_length the length of the record including block_size.
+ * @param references resolved reference names.
+ * @param number_of_references the length of the references array.
+ * @return Py_ssize_t the upper bound or -1 with an error set.
+ */
+static Py_ssize_t
+sam_record_size_bound(const uint8_t *record, Py_ssize_t record_length,
+                      const SamReference *references,
+                      Py_ssize_t number_of_references)
+{
+    if (record_length < BAM_PROPERTIES_STRUCT_SIZE) {
+        PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+        return -1;
+    }
+    int32_t refID;
+    int32_t next_refID;
+    uint16_t n_cigar_op;
+    uint32_t l_seq;
+    uint8_t l_read_name = record[12];
+    memcpy(&refID, record + 4, sizeof(refID));
+    memcpy(&n_cigar_op, record + 16, sizeof(n_cigar_op));
+    memcpy(&l_seq, record + 20, sizeof(l_seq));
+    memcpy(&next_refID, record + 24, sizeof(next_refID));
+    if (l_read_name == 0) {
+        PyErr_SetString(PyExc_ValueError,
+            "Invalid BAM record: l_read_name is 0");
+        return -1;
+    }
+    Py_ssize_t tags_offset = BAM_PROPERTIES_STRUCT_SIZE + l_read_name +
+                             n_cigar_op * sizeof(uint32_t) +
+                             ((l_seq + 1) / 2) + l_seq;
+    if (tags_offset > record_length) {
+        PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+        return -1;
+    }
+    if ((refID < -1) || (refID >= number_of_references)) {
+        PyErr_Format(PyExc_ValueError,
+                     "refID %d is not in the reference list", refID);
+        return -1;
+    }
+    if ((next_refID < -1) || (next_refID >= number_of_references)) {
+        PyErr_Format(PyExc_ValueError,
+                     "next_refID %d is not in the reference list",
+                     next_refID);
+        return -1;
+    }
+    // Ten column tabs; at most 5 characters for flag, 11 for pos, 3 for
+    // mapq, 11 for pnext and 11 for tlen; '*' placeholders for an empty
+    // cigar, seq and qual; and 2 characters of slack because
+    // decode_nibbles emits whole base pairs.
+    Py_ssize_t bound = 10 + 5 + 11 + 3 + 11 + 11 + 3 + 2;
+    bound += l_read_name;
+    bound += (refID >= 0) ? references[refID].length : 1;
+    bound += (next_refID >= 0) ? references[next_refID].length : 1;
+    // Each cigar op takes at most 9 digits plus the operation character.
+    bound += (Py_ssize_t)n_cigar_op * 10;
+    bound += 2 * (Py_ssize_t)l_seq;
+    const uint8_t *tags = record + tags_offset;
+    const uint8_t *tags_end = record + record_length;
+    const uint32_t *cigar = (const uint32_t *)(
+        record + BAM_PROPERTIES_STRUCT_SIZE + l_read_name);
+    if (cigar_is_cg_stub(cigar, n_cigar_op, l_seq)) {
+        const uint8_t *cg_tag = find_cg_tag(tags, tags_end - tags);
+        if (cg_tag == NULL) {
+            return -1;
+        }
+        uint32_t real_n_cigar_op;
+        memcpy(&real_n_cigar_op, cg_tag + 4, sizeof(real_n_cigar_op));
+        bound += (Py_ssize_t)real_n_cigar_op * 10;
+    }
+    const uint8_t *tag_ptr = tags;
+    while (tag_ptr < tags_end) {
+        const uint8_t *next_tag = skip_tag(tag_ptr, tags_end);
+        if (next_tag == NULL) {
+            return -1;
+        }
+        // The tab, two tag characters and the ':%c:' type marker.
+        bound += 6;
+        switch (tag_ptr[2]) {
+            case 'Z':
+            case 'H':
+                // Minus the terminating NULL byte.
+                bound += (next_tag - tag_ptr) - 4;
+                break;
+            case 'B': {
+                uint32_t array_length;
+                memcpy(&array_length, tag_ptr + 4, sizeof(array_length));
+                // The array subtype character plus a comma and at most 24
+                // characters per element.
+                bound += 1 + (Py_ssize_t)array_length * 25;
+                break;
+            }
+            default:
+                bound += 24;
+                break;
+        }
+        tag_ptr = next_tag;
+    }
+    return bound;
+}
+
+/**
+ * @brief Format a raw BAM record as one SAM line without a trailing
+ *        newline. out must hold at least sam_record_size_bound()
+ *        characters and the record must already have been validated by
+ *        that same call.
+ *
+ * @param record pointer to the record, starting at the block_size field.
+ * @param record_length the length of the record including block_size.
+ * @param references resolved reference names.
+ * @param out the output buffer.
+ * @return Py_ssize_t the number of characters written or -1 with an error
+ *         set.
+ */
+static Py_ssize_t
+sam_record_format(const uint8_t *record, Py_ssize_t record_length,
+                  const SamReference *references, char *out)
+{
+    int32_t refID;
+    int32_t position;
+    uint16_t n_cigar_op;
+    uint16_t flag;
+    uint32_t l_seq;
+    int32_t next_refID;
+    int32_t next_position;
+    int32_t template_length;
+    uint8_t l_read_name = record[12];
+    uint8_t mapq = record[13];
+    memcpy(&refID, record + 4, sizeof(refID));
+    memcpy(&position, record + 8, sizeof(position));
+    memcpy(&n_cigar_op, record + 16, sizeof(n_cigar_op));
+    memcpy(&flag, record + 18, sizeof(flag));
+    memcpy(&l_seq, record + 20, sizeof(l_seq));
+    memcpy(&next_refID, record + 24, sizeof(next_refID));
+    memcpy(&next_position, record + 28, sizeof(next_position));
+    memcpy(&template_length, record + 32, sizeof(template_length));
+    const uint8_t *read_name = record + BAM_PROPERTIES_STRUCT_SIZE;
+    const uint32_t *cigar = (const uint32_t *)(read_name + l_read_name);
+    const uint8_t *seq = (const uint8_t *)(cigar + n_cigar_op);
+    const uint8_t *qual = seq + (l_seq + 1) / 2;
+    const uint8_t *tags = qual + l_seq;
+    const uint8_t *tags_end = record + record_length;
+    char *cursor = out;
+
+    memcpy(cursor, read_name, l_read_name - 1);
+    cursor += l_read_name - 1;
+    *cursor = '\t'; cursor += 1;
+    cursor += format_uint32(flag, cursor);
+    *cursor = '\t'; cursor += 1;
+    if (refID == -1) {
+        *cursor = '*'; cursor += 1;
+    } else {
+        memcpy(cursor, references[refID].name, references[refID].length);
+        cursor += references[refID].length;
+    }
+    *cursor = '\t'; cursor += 1;
+    cursor += format_int32(position + 1, cursor);
+    *cursor = '\t'; cursor += 1;
+    cursor += format_uint32(mapq, cursor);
+    *cursor = '\t'; cursor += 1;
+    const uint8_t *cg_tag = NULL;
+    if (n_cigar_op == 0) {
+        *cursor = '*'; cursor += 1;
+    } else if (cigar_is_cg_stub(cigar, n_cigar_op, l_seq)) {
+        cg_tag = find_cg_tag(tags, tags_end - tags);
+        if (cg_tag == NULL) {
+            return -1;
+        }
+        uint32_t real_n_cigar_op;
+        memcpy(&real_n_cigar_op, cg_tag + 4, sizeof(real_n_cigar_op));
+        cursor += format_cigar((const uint32_t *)(cg_tag + 8),
+                               real_n_cigar_op, cursor);
+    } else {
+        cursor += format_cigar(cigar, n_cigar_op, cursor);
+    }
+    *cursor = '\t'; cursor += 1;
+    if (next_refID == -1) {
+        *cursor = '*'; cursor += 1;
+    } else if (next_refID == refID) {
+        *cursor = '='; cursor += 1;
+    } else {
+        memcpy(cursor, references[next_refID].name,
+               references[next_refID].length);
+        cursor += references[next_refID].length;
+    }
+    *cursor = '\t'; cursor += 1;
+    cursor += format_int32(next_position + 1, cursor);
+    *cursor = '\t'; cursor += 1;
+    cursor += format_int32(template_length, cursor);
+    *cursor = '\t'; cursor += 1;
+    if (l_seq == 0) {
+        *cursor = '*'; cursor += 1;
+    } else {
+        // decode_nibbles emits whole base pairs, so for an odd l_seq it
+        // overshoots by one character. That character is overwritten by
+        // the tab below and the size bound leaves room for it.
+        decode_nibbles(seq, (uint8_t *)cursor, (l_seq + 1) / 2);
+        cursor += l_seq;
+    }
+    *cursor = '\t'; cursor += 1;
+    if ((l_seq == 0) || (qual[0] == 0xff)) {
+        // Records without qualities are filled with the 0xFF sentinel.
+        *cursor = '*'; cursor += 1;
+    } else {
+        Py_ssize_t i = shift_bytes_range_checked(
+            qual, (uint8_t *)cursor, l_seq, 0, PHRED_MAX, PHRED_OFFSET);
+        if (i != (Py_ssize_t)l_seq) {
+            PyErr_Format(PyExc_ValueError,
+                "Phred quality %d at index %zd exceeds the maximum of %d",
+                qual[i], i, PHRED_MAX);
+            return -1;
+        }
+        cursor += l_seq;
+    }
+    const uint8_t *tag_ptr = tags;
+    while (tag_ptr < tags_end) {
+        const uint8_t *next_tag = skip_tag(tag_ptr, tags_end);
+        if (next_tag == NULL) {
+            return -1;
+        }
+        if (tag_ptr == cg_tag) {
+            // Already emitted as the cigar column.
+            tag_ptr = next_tag;
+            continue;
+        }
+        cursor[0] = '\t';
+        cursor[1] = tag_ptr[0];
+        cursor[2] = tag_ptr[1];
+        cursor[3] = ':';
+        cursor = sam_format_tag_value(tag_ptr, next_tag, cursor + 4);
+        if (cursor == NULL) {
+            return -1;
+        }
+        tag_ptr = next_tag;
+    }
+    return cursor - out;
+}
+
+/**
+ * @brief Format a raw BAM record as a SAM line str object.
+ *
+ * @return PyObject* an ASCII str object or NULL with an error set.
+ */
+static PyObject *
+sam_line_from_record(const uint8_t *record, Py_ssize_t record_length,
+                     const SamReference *references,
+                     Py_ssize_t number_of_references)
+{
+    Py_ssize_t bound = sam_record_size_bound(
+        record, record_length, references, number_of_references);
+    if (bound < 0) {
+        return NULL;
+    }
+    char *buffer = PyMem_Malloc(bound);
+    if (buffer == NULL) {
+        return PyErr_NoMemory();
+    }
+    Py_ssize_t line_size = sam_record_format(
+        record, record_length, references, buffer);
+    if (line_size < 0) {
+        PyMem_Free(buffer);
+        return NULL;
+    }
+    PyObject *retval = PyUnicode_New(line_size, 127);
+    if (retval == NULL) {
+        PyMem_Free(buffer);
+        return PyErr_NoMemory();
+    }
+    memcpy(PyUnicode_1BYTE_DATA(retval), buffer, line_size);
+    PyMem_Free(buffer);
+    return retval;
+}
+
+PyDoc_STRVAR(BamRecord_to_sam_line__doc__,
+"to_sam_line($self, references, /)\n"
+"--\n"
+"\n"
+"Format the record as one SAM line without a trailing newline.\n"
+"\n"
+"  references\n"
+"    A sequence of reference name strings. The refID and next_refID\n"
+"    fields index into this sequence for the RNAME and RNEXT columns.\n"
+"\n");
+
+#define BAMRECORD_TO_SAM_LINE_METHODDEF    \
+    {"to_sam_line", (PyCFunction)(void(*)(void))BamRecord_to_sam_line, \
+     METH_O, BamRecord_to_sam_line__doc__}
+
+static PyObject *
+BamRecord_to_sam_line(BamRecord *self, PyObject *references_obj)
+{
+    PyObject *sequence = PySequence_Fast(
+        references_obj, "references must be a sequence of strings");
+    if (sequence == NULL) {
+        return NULL;
+    }
+    SamReference *references = sam_references_resolve(sequence);
+    if (references == NULL) {
+        Py_DECREF(sequence);
+        return NULL;
+    }
+    // The variable-length fields live in separate objects, so serialize
+    // the record into its file representation first and format from that.
+    Py_ssize_t record_length = self->block_size + sizeof(self->block_size);
+    char *record = PyMem_Malloc(record_length);
+    if (record == NULL) {
+        PyMem_Free(references);
+        Py_DECREF(sequence);
+        return PyErr_NoMemory();
+    }
+    BamRecord_to_ptr(self, record);
+    PyObject *retval = sam_line_from_record(
+        (const uint8_t *)record, record_length, references,
+        PySequence_Fast_GET_SIZE(sequence));
+    PyMem_Free(record);
+    PyMem_Free(references);
+    Py_DECREF(sequence);
+    return retval;
+}
+
+
+static PyMethodDef BamRecord_methods[] = {
+    BAMRECORD_TO_BYTES_METHODDEF,
+    BAMRECORD_FROM_BYTES_METHODDEF,
+    BAMRECORD___REDUCE___METHODDEF,
+    BAMRECORD_TO_SAM_LINE_METHODDEF,
+    BAMRECORD_GET_SEQUENCE_METHODDEF,
+    BAMRECORD_SET_SEQUENCE_METHODDEF,
+    BAMRECORD_GET_QUALITY_STRING_METHODDEF,
+    BAMRECORD_SET_QUALITY_STRING_METHODDEF,
     BAMRECORD_GET_TAG_METHODDEF,
+    BAMRECORD_GET_TAGS_DICT_METHODDEF,
     BAMRECORD_SET_TAG_METHODDEF,
+    BAMRECORD_SET_TAGS_METHODDEF,
+    {NULL}
+};
+
+PyDoc_STRVAR(BamRecord__doc__, 
+"An object that represents an alignment record from a BAM file.");
+
+static PyTypeObject BamRecord_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    // The full dotted import path, so pickle can resolve the class when
+    // serializing the from_bytes classmethod returned by __reduce__.
+    .tp_name = "htspy._bam.BamRecord",
+    .tp_basicsize = sizeof(BamRecord),
+    .tp_dealloc = (destructor)BamRecord_dealloc,      
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = BamRecord__doc__,
+    .tp_methods = BamRecord_methods,
+    .tp_members = BamRecord_members,   
+    .tp_getset = BamRecord_properties,
+    .tp_init = (initproc)BamRecord_init,
+    .tp_new = PyType_GenericNew,
+};
+
+// A read-only view of one BAM record inside a larger buffer. The fixed-size
+// fields are copied into the struct on creation, which is cheap. The
+// variable-length fields (read_name, cigar, seq, qual, tags) stay in the
+// underlying buffer and are only converted to Python objects on first
+// access, after which they are cached in the slots below. The source member
+// keeps the underlying buffer alive. The fixed-size fields deliberately
+// mirror the BamRecord layout so the flag property implementations can be
+// shared.
+typedef struct {
+    PyObject_HEAD
+    uint32_t block_size;
+    int32_t refID;
+    int32_t pos;
+    uint8_t l_read_name;
+    uint8_t mapq;
+    uint16_t bin;
+    uint16_t n_cigar_op;
+    uint16_t flag;
+    uint32_t l_seq;
+    int32_t next_refID;
+    int32_t next_pos;
+    int32_t tlen;
+    PyObject * read_name;
+    PyObject * bamcigar;
+    PyObject * seq;
+    PyObject * qual;
+    PyObject * tags;
+    PyObject * source;
+    const uint8_t * record;
+    // When set, the cached variable-length fields are memoryview slices
+    // into the source buffer instead of bytes copies, so one block
+    // allocation backs the fields of all its records.
+    char zero_copy;
+} LazyBamRecord;
+
+static PyTypeObject LazyBamRecord_Type;  // Forward declaration
+
+static void
+LazyBamRecord_dealloc(LazyBamRecord *self) {
+    Py_CLEAR(self->read_name);
+    Py_CLEAR(self->bamcigar);
+    Py_CLEAR(self->seq);
+    Py_CLEAR(self->qual);
+    Py_CLEAR(self->tags);
+    Py_CLEAR(self->source);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/**
+ * @brief Create a read-only memoryview of length bytes at offset in the
+ *        record. The view holds a reference to the source buffer, so the
+ *        block arena stays alive as long as the view does.
+ */
+static PyObject *
+lazy_field_view(LazyBamRecord *self, Py_ssize_t offset, Py_ssize_t length)
+{
+    Py_buffer info;
+    if (PyBuffer_FillInfo(&info, self->source,
+                          (void *)(self->record + offset), length,
+                          1, PyBUF_SIMPLE) != 0) {
+        return NULL;
+    }
+    PyObject *memview = PyMemoryView_FromBuffer(&info);
+    if (memview == NULL) {
+        PyBuffer_Release(&info);
+        return NULL;
+    }
+    // PyMemoryView_FromBuffer sets this to NULL, but the underlying
+    // object should be properly decreased in reference count.
+    ((PyMemoryViewObject *)memview)->mbuf->master.obj = self->source;
+    return memview;
+}
+
+// Offsets of the variable-length fields within the record.
+#define LAZY_READ_NAME_OFFSET BAM_PROPERTIES_STRUCT_SIZE
+#define LAZY_CIGAR_OFFSET(self) \
+    (LAZY_READ_NAME_OFFSET + (self)->l_read_name)
+#define LAZY_SEQ_OFFSET(self) \
+    (LAZY_CIGAR_OFFSET(self) + (self)->n_cigar_op * sizeof(uint32_t))
+#define LAZY_QUAL_OFFSET(self) \
+    (LAZY_SEQ_OFFSET(self) + (((self)->l_seq + 1) / 2))
+#define LAZY_TAGS_OFFSET(self) \
+    (LAZY_QUAL_OFFSET(self) + (self)->l_seq)
+
+static PyObject *
+LazyBamRecord_get__read_name(LazyBamRecord *self, void *closure) {
+    if (self->read_name == NULL) {
+        self->read_name = self->zero_copy ?
+            lazy_field_view(self, LAZY_READ_NAME_OFFSET,
+                            self->l_read_name - 1) :
+            PyBytes_FromStringAndSize(
+                (char *)self->record + LAZY_READ_NAME_OFFSET,
+                self->l_read_name - 1);
+        if (self->read_name == NULL) {
+            return NULL;
+        }
+    }
+    Py_INCREF(self->read_name);
+    return self->read_name;
+}
+
+static PyObject *
+LazyBamRecord_get_read_name(LazyBamRecord *self, void *closure) {
+    return PyUnicode_DecodeASCII(
+        (char *)self->record + LAZY_READ_NAME_OFFSET,
+        self->l_read_name - 1, "strict");
+}
+
+static PyObject *
+LazyBamRecord_get_cigar(LazyBamRecord *self, void *closure) {
+    if (self->bamcigar == NULL) {
+        self->bamcigar = BamCigar_FromPointerAndSize(
+            (uint32_t *)(self->record + LAZY_CIGAR_OFFSET(self)),
+            self->n_cigar_op);
+        if (self->bamcigar == NULL) {
+            return NULL;
+        }
+    }
+    if (cigar_is_cg_stub(BamCigar_GET_CIGAR(self->bamcigar),
+                         self->n_cigar_op, self->l_seq)) {
+        Py_ssize_t tags_offset = LAZY_TAGS_OFFSET(self);
+        return cigar_from_cg_tag(self->record + tags_offset,
+                                 self->block_size + 4 - tags_offset);
+    }
+    Py_INCREF(self->bamcigar);
+    return self->bamcigar;
+}
+
+static PyObject *
+LazyBamRecord_get__cigar(LazyBamRecord *self, void *closure) {
+    if (self->bamcigar == NULL) {
+        self->bamcigar = BamCigar_FromPointerAndSize(
+            (uint32_t *)(self->record + LAZY_CIGAR_OFFSET(self)),
+            self->n_cigar_op);
+        if (self->bamcigar == NULL) {
+            return NULL;
+        }
+    }
+    Py_INCREF(self->bamcigar);
+    return self->bamcigar;
+}
+
+static PyObject *
+LazyBamRecord_get_reference_end(LazyBamRecord *self, void *closure) {
+    // Walks the cigar straight in the underlying buffer, so neither a
+    // BamCigar object nor per-operation tuples are created.
+    uint64_t reference_length = cigar_consumed_length(
+        self->record + LAZY_CIGAR_OFFSET(self), self->n_cigar_op, 2);
+    if (reference_length == 0) {
+        reference_length = 1;
+    }
+    return PyLong_FromLongLong(self->pos + (int64_t)reference_length);
+}
+
+static PyObject *
+LazyBamRecord_get__seq(LazyBamRecord *self, void *closure) {
+    if (self->seq == NULL) {
+        self->seq = self->zero_copy ?
+            lazy_field_view(self, LAZY_SEQ_OFFSET(self),
+                            (self->l_seq + 1) / 2) :
+            PyBytes_FromStringAndSize(
+                (char *)self->record + LAZY_SEQ_OFFSET(self),
+                (self->l_seq + 1) / 2);
+        if (self->seq == NULL) {
+            return NULL;
+        }
+    }
+    Py_INCREF(self->seq);
+    return self->seq;
+}
+
+static PyObject *
+LazyBamRecord_get__qual(LazyBamRecord *self, void *closure) {
+    if (self->qual == NULL) {
+        self->qual = self->zero_copy ?
+            lazy_field_view(self, LAZY_QUAL_OFFSET(self), self->l_seq) :
+            PyBytes_FromStringAndSize(
+                (char *)self->record + LAZY_QUAL_OFFSET(self), self->l_seq);
+        if (self->qual == NULL) {
+            return NULL;
+        }
+    }
+    Py_INCREF(self->qual);
+    return self->qual;
+}
+
+static PyObject *
+LazyBamRecord_get__tags(LazyBamRecord *self, void *closure) {
+    if (self->tags == NULL) {
+        Py_ssize_t tags_offset = LAZY_TAGS_OFFSET(self);
+        self->tags = self->zero_copy ?
+            lazy_field_view(self, tags_offset,
+                            self->block_size + 4 - tags_offset) :
+            PyBytes_FromStringAndSize(
+                (char *)self->record + tags_offset,
+                self->block_size + 4 - tags_offset);
+        if (self->tags == NULL) {
+            return NULL;
+        }
+    }
+    Py_INCREF(self->tags);
+    return self->tags;
+}
+
+static PyObject *
+LazyBamRecord_get_sequence(LazyBamRecord *self, PyObject *Py_UNUSED(ignore)) {
+    // Decode straight from the underlying buffer. The encoded sequence
+    // bytes object is not needed for this.
+    return decode_bam_sequence(self->record + LAZY_SEQ_OFFSET(self),
+                               self->l_seq);
+}
+
+static PyObject *
+LazyBamRecord_get_quality_string(LazyBamRecord *self,
+                                 PyObject *Py_UNUSED(ignore)) {
+    return quality_string_from_ptr(self->record + LAZY_QUAL_OFFSET(self),
+                                   self->l_seq);
+}
+
+static PyObject *
+LazyBamRecord_get_tag(LazyBamRecord *self, PyObject *tag) {
+    PyObject *tags = LazyBamRecord_get__tags(self, NULL);
+    if (tags == NULL) {
+        return NULL;
+    }
+    PyObject *retval = tags_object_get_tag(tags, tag);
+    Py_DECREF(tags);
+    return retval;
+}
+
+static PyObject *
+LazyBamRecord_get_tags_dict(LazyBamRecord *self, PyObject *Py_UNUSED(ignore)) {
+    PyObject *tags = LazyBamRecord_get__tags(self, NULL);
+    if (tags == NULL) {
+        return NULL;
+    }
+    PyObject *retval = tags_object_to_dict(tags);
+    Py_DECREF(tags);
+    return retval;
+}
+
+static PyObject *
+LazyBamRecord_to_bytes(LazyBamRecord *self, PyObject *Py_UNUSED(ignore)) {
+    // The record is still in its file representation, so this is one copy.
+    return PyBytes_FromStringAndSize((char *)self->record,
+                                     self->block_size + 4);
+}
+
+static PyObject *
+LazyBamRecord_to_sam_line(LazyBamRecord *self, PyObject *references_obj) {
+    PyObject *sequence = PySequence_Fast(
+        references_obj, "references must be a sequence of strings");
+    if (sequence == NULL) {
+        return NULL;
+    }
+    SamReference *references = sam_references_resolve(sequence);
+    if (references == NULL) {
+        Py_DECREF(sequence);
+        return NULL;
+    }
+    // The record is still in its file representation, so it can be
+    // formatted straight from the underlying buffer.
+    PyObject *retval = sam_line_from_record(
+        self->record, self->block_size + 4, references,
+        PySequence_Fast_GET_SIZE(sequence));
+    PyMem_Free(references);
+    Py_DECREF(sequence);
+    return retval;
+}
+
+static PyMemberDef LazyBamRecord_members[] = {
+    // Same naming convention as BamRecord: BAM spec names prepended with an
+    // underscore, plus readable Pythonic names. All READONLY: a lazy record
+    // is a view and cannot be modified.
+    {"_block_size", T_UINT, offsetof(LazyBamRecord, block_size), READONLY},
+    {"_refID", T_INT, offsetof(LazyBamRecord, refID), READONLY},
+    {"_pos", T_INT, offsetof(LazyBamRecord, pos), READONLY},
+    {"_l_read_name", T_UBYTE, offsetof(LazyBamRecord, l_read_name), READONLY},
+    {"_mapq", T_UBYTE, offsetof(LazyBamRecord, mapq), READONLY},
+    {"_bin", T_USHORT, offsetof(LazyBamRecord, bin), READONLY},
+    {"_n_cigar_op", T_USHORT, offsetof(LazyBamRecord, n_cigar_op), READONLY},
+    {"_flag", T_USHORT, offsetof(LazyBamRecord, flag), READONLY},
+    {"_l_seq", T_UINT, offsetof(LazyBamRecord, l_seq), READONLY},
+    {"_next_refID", T_INT, offsetof(LazyBamRecord, next_refID), READONLY},
+    {"_next_pos", T_INT, offsetof(LazyBamRecord, next_pos), READONLY},
+    {"_tlen", T_INT, offsetof(LazyBamRecord, tlen), READONLY},
+    {"reference_id", T_INT, offsetof(LazyBamRecord, refID), READONLY,
+     "The index number referring to the reference."},
+    {"position", T_INT, offsetof(LazyBamRecord, pos), READONLY,
+     "The leftmost position where the template alignment starts (0-based)."},
+    {"mapping_quality", T_UBYTE, offsetof(LazyBamRecord, mapq), READONLY,
+     "The quality of the mapping."},
+    {"flag", T_USHORT, offsetof(LazyBamRecord, flag), READONLY,
+     "Bitwise flags."},
+    {"next_position", T_INT, offsetof(LazyBamRecord, next_pos), READONLY,
+     "next_pos: The leftmost position of the next segment."},
+    {"template_length", T_INT, offsetof(LazyBamRecord, tlen), READONLY},
+    {NULL}
+};
+
+static PyGetSetDef LazyBamRecord_properties[] = {
+    {"read_name", (getter)LazyBamRecord_get_read_name, NULL,
+     BamRecord_read_name_doc, NULL},
+    {"_read_name", (getter)LazyBamRecord_get__read_name, NULL,
+     BamRecord__read_name_doc, NULL},
+    {"_tags", (getter)LazyBamRecord_get__tags, NULL,
+     BamRecord_tags_doc, NULL},
+    {"cigar", (getter)LazyBamRecord_get_cigar, NULL,
+     BamRecord_cigar_doc, NULL},
+    {"_cigar", (getter)LazyBamRecord_get__cigar, NULL,
+     BamRecord_cigar_doc, NULL},
+    {"reference_end", (getter)LazyBamRecord_get_reference_end, NULL,
+     BamRecord_reference_end_doc, NULL},
+    {"_seq", (getter)LazyBamRecord_get__seq, NULL, NULL, NULL},
+    {"_qual", (getter)LazyBamRecord_get__qual, NULL, NULL, NULL},
+    {"qualities", (getter)LazyBamRecord_get__qual, NULL, NULL, NULL},
+    // The flag field has the same offset as in BamRecord, so the flag
+    // property implementations can be reused directly.
+    {"is_paired", (getter)BamRecord_is_paired, NULL,
+     BamRecord_is_paired_doc, NULL},
+    {"is_proper_pair", (getter)BamRecord_is_proper_pair, NULL,
+     BamRecord_is_proper_pair_doc, NULL},
+    {"is_unmapped", (getter)BamRecord_is_unmapped, NULL,
+     BamRecord_is_unmapped_doc, NULL},
+    {"mate_is_unmapped", (getter)BamRecord_mate_is_unmapped, NULL,
+     BamRecord_mate_is_unmapped_doc, NULL},
+    {"is_reverse", (getter)BamRecord_is_reverse, NULL,
+     BamRecord_is_reverse_doc, NULL},
+    {"mate_is_reverse", (getter)BamRecord_mate_is_reverse, NULL,
+     BamRecord_mate_is_reverse_doc, NULL},
+    {"is_read1", (getter)BamRecord_is_read1, NULL,
+     BamRecord_is_read1_doc, NULL},
+    {"is_read2", (getter)BamRecord_is_read2, NULL,
+     BamRecord_is_read2_doc, NULL},
+    {"is_secondary", (getter)BamRecord_is_secondary, NULL,
+     BamRecord_is_secondary_doc},
+    {"is_qcfail", (getter)BamRecord_is_qcfail, NULL,
+     BamRecord_is_qcfail_doc},
+    {"is_duplicate", (getter)BamRecord_is_duplicate, NULL,
+     BamRecord_is_duplicate_doc, NULL},
+    {"is_supplementary", (getter)BamRecord_is_supplementary, NULL,
+     BamRecord_is_supplementary_doc, NULL},
+    {NULL}
+};
+
+static PyMethodDef LazyBamRecord_methods[] = {
+    {"to_bytes", (PyCFunction)(void(*)(void))LazyBamRecord_to_bytes,
+     METH_NOARGS, BamRecord_to_bytes__doc__},
+    {"to_sam_line", (PyCFunction)(void(*)(void))LazyBamRecord_to_sam_line,
+     METH_O, BamRecord_to_sam_line__doc__},
+    {"get_sequence", (PyCFunction)(void(*)(void))LazyBamRecord_get_sequence,
+     METH_NOARGS, BamRecord_get_sequence__doc__},
+    {"get_quality_string",
+     (PyCFunction)(void(*)(void))LazyBamRecord_get_quality_string,
+     METH_NOARGS, BamRecord_get_quality_string__doc__},
+    {"get_tag", (PyCFunction)(void(*)(void))LazyBamRecord_get_tag,
+     METH_O, BamRecord_get_tag__doc__},
+    {"get_tags_dict", (PyCFunction)(void(*)(void))LazyBamRecord_get_tags_dict,
+     METH_NOARGS, BamRecord_get_tags_dict__doc__},
+    {NULL}
+};
+
+PyDoc_STRVAR(LazyBamRecord__doc__,
+"A read-only view of an alignment record inside a BAM block buffer.\n"
+"\n"
+"The variable-length fields are only decoded on first attribute access.\n"
+"Created by bam_iterator(data, lazy=True). The view keeps a reference to\n"
+"the underlying buffer.");
+
+static PyTypeObject LazyBamRecord_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_bam.LazyBamRecord",
+    .tp_basicsize = sizeof(LazyBamRecord),
+    .tp_dealloc = (destructor)LazyBamRecord_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = LazyBamRecord__doc__,
+    .tp_methods = LazyBamRecord_methods,
+    .tp_members = LazyBamRecord_members,
+    .tp_getset = LazyBamRecord_properties,
+};
+
+PyDoc_STRVAR(BamBlockBuffer__doc__,
+"A structure to create a BGZF block from BamRecord objects.\n");
+
+typedef struct {
+    PyObject_HEAD
+    Py_ssize_t buffersize;
+    Py_ssize_t pos;
+    char * buffer;
+} BamBlockBuffer;
+
+static void
+BamBlockBuffer_dealloc(BamBlockBuffer *self) {
+    PyMem_Free(self->buffer);
+    Py_TYPE(self)->tp_free(self);
+}
+
+static int
+BamBlockBuffer__init__(BamBlockBuffer * self, PyObject *args, PyObject *kwargs) {
+    Py_ssize_t buffersize = BGZF_BLOCK_SIZE;
+    self->buffer = NULL;
+    char * tmp;
+    char * keywords[] = {"", NULL};
+    if (!PyArg_ParseTupleAndKeywords(
+        args, kwargs, "|n:BamBlockBuffer", keywords, &buffersize)) {
+            return -1;
+    }
+    if (buffersize < 0) {
+        PyErr_Format(PyExc_ValueError,
+                     "buffer size must be larger than 0. Got: %ld", buffersize);
+        return -1;
+    }
+    tmp = (char *)PyMem_Malloc(buffersize);
+    if (tmp == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->buffer = tmp;
+    self->buffersize = buffersize;
+    self->pos = 0;
+    return 0;
+}
+
+static PyMemberDef BamBlockBuffer_members[] = {
+    {"buffersize", T_PYSSIZET, offsetof(BamBlockBuffer, buffersize), READONLY,
+     "The size of the internal buffer."},
+    {"bytes_written", T_PYSSIZET, offsetof(BamBlockBuffer, pos), READONLY,
+     "The number of bytes written in the internal buffer."},
+    {NULL}
+};
+
+
+PyDoc_STRVAR(BamBlockBuffer_write_doc,
+"Write a BamRecord object into the BamBlockBuffer.\n"
+"\n"
+"Returns the amount of bytes written. Returns 0 if the BamRecord does not\n"
+"fit in the buffer anymore");
+
+#define BAMBLOCKBUFFER_WRITE_METHODDEF    \
+    {"write", (PyCFunction)(void(*)(void))BamBlockBuffer_write, METH_O, \
+     BamBlockBuffer_write_doc}
+
+static PyObject * 
+BamBlockBuffer_write(BamBlockBuffer * self, BamRecord * bam_record) {
+    if (Py_TYPE(bam_record) != &BamRecord_Type) {
+        PyErr_Format(PyExc_TypeError, "Type must be BamRecord, got: %s",
+                     Py_TYPE(bam_record)->tp_name);
+        return NULL;
+    }
+    Py_ssize_t record_size = bam_record->block_size + sizeof(bam_record->block_size);
+    Py_ssize_t final_pos = self->pos + record_size;
+    if (final_pos > self->buffersize) {
+        return PyLong_FromSsize_t(0);
+    }
+    BamRecord_to_ptr(bam_record, self->buffer + self->pos);
+    self->pos = final_pos;
+    return PyLong_FromSsize_t(record_size);
+}
+PyDoc_STRVAR(BamBlockBuffer_write_many_doc,
+"write_many($self, records, start=0, /)\n"
+"--\n"
+"\n"
+"Write a sequence of BamRecord objects into the BamBlockBuffer,\n"
+"starting at index start, in one call.\n"
+"\n"
+"Returns the number of records that were written. When this is less\n"
+"than the number of remaining records the buffer is full and should be\n"
+"flushed, after which the call can be repeated with an updated start.");
+
+#define BAMBLOCKBUFFER_WRITE_MANY_METHODDEF    \
+    {"write_many", (PyCFunction)(void(*)(void))BamBlockBuffer_write_many, \
+     METH_VARARGS, BamBlockBuffer_write_many_doc}
+
+static PyObject *
+BamBlockBuffer_write_many(BamBlockBuffer * self, PyObject *args) {
+    PyObject * records_obj;
+    Py_ssize_t start = 0;
+    if (!PyArg_ParseTuple(args, "O|n:write_many", &records_obj, &start)) {
+        return NULL;
+    }
+    PyObject * records = PySequence_Fast(
+        records_obj, "write_many expects a sequence of BamRecord objects");
+    if (records == NULL) {
+        return NULL;
+    }
+    Py_ssize_t number_of_records = PySequence_Fast_GET_SIZE(records);
+    Py_ssize_t records_written = 0;
+    for (Py_ssize_t i = start; i < number_of_records; i += 1) {
+        BamRecord * bam_record =
+            (BamRecord *)PySequence_Fast_GET_ITEM(records, i);
+        if (Py_TYPE(bam_record) != &BamRecord_Type) {
+            PyErr_Format(PyExc_TypeError, "Type must be BamRecord, got: %s",
+                         Py_TYPE(bam_record)->tp_name);
+            Py_DECREF(records);
+            return NULL;
+        }
+        Py_ssize_t record_size = bam_record->block_size +
+                                 sizeof(bam_record->block_size);
+        if (self->pos + record_size > self->buffersize) {
+            break;
+        }
+        BamRecord_to_ptr(bam_record, self->buffer + self->pos);
+        self->pos += record_size;
+        records_written += 1;
+    }
+    Py_DECREF(records);
+    return PyLong_FromSsize_t(records_written);
+}
+
+PyDoc_STRVAR(BamBlockBuffer_reset_doc,
+"Remove all records from the buffer.");
+
+#define BAMBLOCKBUFFER_RESET_METHODDEF    \
+    {"reset", (PyCFunction)(void(*)(void))BamBlockBuffer_reset, METH_NOARGS, \
+     BamBlockBuffer_reset_doc}
+
+static PyObject *
+BamBlockBuffer_reset(BamBlockBuffer *self, PyObject *Py_UNUSED(ignore)) {
+    self->pos = 0;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(BamBlockBuffer_get_block_view_doc,
+"Return a memoryview over all the memory blocks written so far.");
+
+#define BAMBLOCKBUFFER_GET_BLOCK_VIEW_METHODDEF    \
+    {"get_block_view", (PyCFunction)(void(*)(void))BamBlockBuffer_get_block_view, \
+     METH_NOARGS, BamBlockBuffer_get_block_view_doc}
+
+static PyObject *
+BamBlockBuffer_get_block_view(BamBlockBuffer *self, PyObject *Py_UNUSED(ignore)) {
+    return PyMemoryView_FromMemory(self->buffer, self->pos, PyBUF_READ);
+}
+
+static PyMethodDef BamBlockBuffer_methods[] = {
+    BAMBLOCKBUFFER_WRITE_METHODDEF,
+    BAMBLOCKBUFFER_WRITE_MANY_METHODDEF,
+    BAMBLOCKBUFFER_RESET_METHODDEF,
+    BAMBLOCKBUFFER_GET_BLOCK_VIEW_METHODDEF,
+    {NULL},
+};
+
+static PyTypeObject BamBlockBuffer_Type = {
+    .tp_name = "_bam.BamBlockBuffer",
+    .tp_basicsize = sizeof(BamBlockBuffer),
+    .tp_dealloc = (destructor)BamBlockBuffer_dealloc,
+    .tp_init = (initproc)BamBlockBuffer__init__,
+    .tp_new = PyType_GenericNew,
+    .tp_doc = BamBlockBuffer__doc__,
+    .tp_members = BamBlockBuffer_members,
+    .tp_methods = BamBlockBuffer_methods,
+};
+
+typedef struct {
+    PyObject_HEAD
+    Py_buffer view;
+    char * buf;
+    Py_ssize_t pos;
+    Py_ssize_t len;
+    int lazy;
+    int views;
+    int recycle;
+    PyObject * recycled;
+    // Predicate pushdown filter, evaluated on the raw record bytes before
+    // any field objects are created. See bam_iterator().
+    int filtered;
+    uint16_t flag_include;
+    uint16_t flag_exclude;
+    uint8_t min_mapq;
+    int32_t region_refID;  // -1 when no region filter is set.
+    int64_t region_start;
+    int64_t region_end;
+    // Instrumentation: the number of records this iterator has yielded.
+    uint64_t records_yielded;
+} BamIterator;
+
+/**
+ * @brief Evaluate the iterator's filter on a raw, length-validated record.
+ *
+ * @return int 1 when the record passes, 0 when it should be skipped and
+ *         -1 when the record is too short to hold its own cigar.
+ */
+static int
+BamIterator_record_passes_filter(BamIterator *self, const uint8_t *record)
+{
+    int32_t refID;
+    int32_t pos;
+    uint16_t flag;
+    memcpy(&refID, record + 4, sizeof(refID));
+    memcpy(&pos, record + 8, sizeof(pos));
+    memcpy(&flag, record + 18, sizeof(flag));
+    uint8_t mapq = record[13];
+    if ((flag & self->flag_include) != self->flag_include) {
+        return 0;
+    }
+    if (flag & self->flag_exclude) {
+        return 0;
+    }
+    if (mapq < self->min_mapq) {
+        return 0;
+    }
+    if (self->region_refID >= 0) {
+        if (refID != self->region_refID) {
+            return 0;
+        }
+        if (pos >= self->region_end) {
+            return 0;
+        }
+        // The end position requires walking the cigar, which is still much
+        // cheaper than materializing the record.
+        uint32_t block_size;
+        memcpy(&block_size, record, sizeof(block_size));
+        uint8_t l_read_name = record[12];
+        uint16_t n_cigar_op;
+        memcpy(&n_cigar_op, record + 16, sizeof(n_cigar_op));
+        const uint8_t *cigar = record + BAM_PROPERTIES_STRUCT_SIZE +
+                               l_read_name;
+        if (BAM_PROPERTIES_STRUCT_SIZE + l_read_name +
+                n_cigar_op * sizeof(uint32_t) > (size_t)block_size + 4) {
+            return -1;
+        }
+        int64_t reference_length = (int64_t)cigar_consumed_length(
+            cigar, n_cigar_op, 2);
+        if (reference_length == 0) {
+            // Records without a reference-consuming cigar span one base.
+            reference_length = 1;
+        }
+        if (pos + reference_length <= self->region_start) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void
+BamIterator_dealloc(BamIterator *self) {
+    Py_CLEAR(self->recycled);
+    PyBuffer_Release(&(self->view));
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static BamIterator *
+BamIterator_iter(BamIterator *self){
+    Py_INCREF(self);
+    return self;
+}
+
+static PyObject *
+BamIterator_iternext(BamIterator *self){
+    if (self->filtered) {
+        // Skip records failing the predicate by advancing over their raw
+        // bytes, before any field objects are created.
+        while (self->pos < self->len) {
+            if ((self->len - self->pos) < BAM_PROPERTIES_STRUCT_SIZE) {
+                PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+                return NULL;
+            }
+            const uint8_t *record = (const uint8_t *)(self->buf + self->pos);
+            uint32_t block_size;
+            memcpy(&block_size, record, sizeof(block_size));
+            if (self->pos + (Py_ssize_t)block_size + 4 > self->len) {
+                PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+                return NULL;
+            }
+            int passes = BamIterator_record_passes_filter(self, record);
+            if (passes == -1) {
+                PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+                return NULL;
+            }
+            if (passes) {
+                break;
+            }
+            self->pos += (Py_ssize_t)block_size + 4;
+        }
+    }
+    if (self->pos >= self->len){
+        PyErr_SetNone(PyExc_StopIteration);
+        return NULL;
+    }
+    Py_ssize_t start_pos = self->pos;
+
+    if (self->lazy) {
+        if ((self->len - self->pos) < BAM_PROPERTIES_STRUCT_SIZE) {
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+            return NULL;
+        }
+        LazyBamRecord * record = PyObject_New(LazyBamRecord,
+                                              &LazyBamRecord_Type);
+        if (record == NULL) {
+            return PyErr_NoMemory();
+        }
+        // The fixed-size fields in LazyBamRecord follow the same layout as
+        // in BamRecord, so the bam file data can be copied directly into
+        // the struct.
+        memcpy((char *)record + BAM_PROPERTIES_STRUCT_START,
+               self->buf + self->pos,
+               BAM_PROPERTIES_STRUCT_SIZE);
+        Py_ssize_t lazy_record_length = record->block_size + 4;
+        if (self->pos + lazy_record_length > self->len) {
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+            record->read_name = NULL;
+            record->bamcigar = NULL;
+            record->seq = NULL;
+            record->qual = NULL;
+            record->tags = NULL;
+            record->source = NULL;
+            Py_DECREF(record);
+            return NULL;
+        }
+        record->read_name = NULL;
+        record->bamcigar = NULL;
+        record->seq = NULL;
+        record->qual = NULL;
+        record->tags = NULL;
+        Py_INCREF(self);
+        record->source = (PyObject *)self;
+        record->record = (const uint8_t *)(self->buf + start_pos);
+        record->zero_copy = (char)self->views;
+        self->pos = start_pos + lazy_record_length;
+        self->records_yielded += 1;
+        return (PyObject *)record;
+    }
+
+    BamRecord * bam_record;
+    if (self->recycle && (self->recycled != NULL)) {
+        // Reuse the previous record and only replace its field objects.
+        // The caller promised not to keep references to yielded records;
+        // a kept reference observes the record change in place.
+        bam_record = (BamRecord *)self->recycled;
+        Py_INCREF(bam_record);
+        BamRecord_invalidate_tag_index(bam_record);
+        Py_CLEAR(bam_record->read_name);
+        Py_CLEAR(bam_record->bamcigar);
+        Py_CLEAR(bam_record->seq);
+        Py_CLEAR(bam_record->qual);
+        Py_CLEAR(bam_record->tags);
+    } else {
+        bam_record = BamRecord_New();
+        if (bam_record == NULL) {
+            return PyErr_NoMemory();
+        }
+        if (self->recycle) {
+            Py_INCREF(bam_record);
+            Py_XSETREF(self->recycled, (PyObject *)bam_record);
+        }
+    }
+    bam_record->read_name = NULL;
+    bam_record->seq = NULL;
+    bam_record->bamcigar = NULL;
+    bam_record->qual = NULL;
+    bam_record->tags = NULL;
+
+    if ((self->len - self->pos) < BAM_PROPERTIES_STRUCT_SIZE) {
+        PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+        Py_DECREF(bam_record);
+        return NULL;
+    }
+    // Copy the bam file data directly into the struct.
+    memcpy((char *)bam_record + BAM_PROPERTIES_STRUCT_START,
+            self->buf + self->pos,
+            BAM_PROPERTIES_STRUCT_SIZE);
+
+    // Block_size is excluding the block_size field it self.
+    Py_ssize_t record_length = bam_record->block_size + 4;
+    if (self->pos + record_length > self->len) {
+        PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+        Py_DECREF(bam_record);
+        return NULL;
+    }
+    self->pos += BAM_PROPERTIES_STRUCT_SIZE;
+    bam_record->read_name = PyBytes_FromStringAndSize(
+        self->buf + self->pos, bam_record->l_read_name -1);
+    self->pos += bam_record->l_read_name;
+
+    Py_ssize_t cigar_length = bam_record->n_cigar_op * sizeof(uint32_t);
+    bam_record->bamcigar = BamCigar_FromPointerAndSize(
+        (uint32_t *)(self->buf + self->pos), bam_record->n_cigar_op);
+    self->pos += cigar_length;
+
+    Py_ssize_t seq_length = (bam_record->l_seq + 1) / 2;
+    bam_record->seq = PyBytes_FromStringAndSize(
+        self->buf + self->pos, seq_length);
+    self->pos += seq_length;
+
+    bam_record->qual = PyBytes_FromStringAndSize(
+        self->buf + self->pos, bam_record->l_seq);
+    self->pos += bam_record->l_seq;
+
+    // Tags are in the remaining block of data.
+    Py_ssize_t tags_length = start_pos + record_length - self->pos;
+    bam_record->tags = PyBytes_FromStringAndSize(
+        self->buf + self-> pos, tags_length);
+    
+    // Should be equal to record_length
+    self->pos += tags_length;
+
+    // Check if any of the bytes objects was NULL. This means there was 
+    // no memory available.
+    if ((bam_record->read_name == NULL) | (bam_record->tags == NULL) |
+        (bam_record->seq == NULL) | (bam_record->qual == NULL) |
+        (bam_record->tags == NULL)) {
+        Py_DECREF(bam_record);
+        return PyErr_NoMemory();
+    }
+
+    self->records_yielded += 1;
+    return (PyObject *)bam_record;
+}
+
+static PyMemberDef BamIterator_members[] = {
+    {"records_yielded", T_ULONGLONG, offsetof(BamIterator, records_yielded),
+     READONLY, "The number of records this iterator has yielded."},
     {NULL}
 };
 
-PyDoc_STRVAR(BamRecord__doc__, 
-"An object that represents an alignment record from a BAM file.");
-
-static PyTypeObject BamRecord_Type = {
+static PyTypeObject BamIterator_Type = {
     PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "_bam.BamRecord",
-    .tp_basicsize = sizeof(BamRecord),
-    .tp_dealloc = (destructor)BamRecord_dealloc,      
+    .tp_name = "_bam.BamIterator", 
+    .tp_basicsize = sizeof(BamIterator),
+    .tp_dealloc =(destructor)BamIterator_dealloc,  
     .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_doc = BamRecord__doc__,
-    .tp_methods = BamRecord_methods,
-    .tp_members = BamRecord_members,   
-    .tp_getset = BamRecord_properties,
-    .tp_init = (initproc)BamRecord_init,
-    .tp_new = PyType_GenericNew,
+    .tp_iter = (getiterfunc)BamIterator_iter,
+    .tp_iternext = (iternextfunc)BamIterator_iternext,
+    .tp_members = BamIterator_members,
 };
 
-PyDoc_STRVAR(BamBlockBuffer__doc__,
-"A structure to create a BGZF block from BamRecord objects.\n");
-
-typedef struct {
-    PyObject_HEAD
-    Py_ssize_t buffersize;
-    Py_ssize_t pos;
-    char * buffer;
-} BamBlockBuffer;
-
-static void
-BamBlockBuffer_dealloc(BamBlockBuffer *self) {
-    PyMem_Free(self->buffer);
-    Py_TYPE(self)->tp_free(self);
-}
-
-static int
-BamBlockBuffer__init__(BamBlockBuffer * self, PyObject *args, PyObject *kwargs) {
-    Py_ssize_t buffersize = BGZF_BLOCK_SIZE;
-    self->buffer = NULL;
-    char * tmp;
-    char * keywords[] = {"", NULL};
+PyDoc_STRVAR(bam_iterator_doc,
+"bam_iterator($module, data, /, lazy=False, views=False, recycle=False,\n"
+"             flag_include=0, flag_exclude=0, min_mapq=0, region=None)\n"
+"--\n"
+"\n"
+"Return an iterator that yields BamRecord objects.\n"
+"\n"
+"  data\n"
+"    A block of raw BAM Record data. May be any object\n"
+"    that supports the buffer protocol: bytes, bytearray, memoryview.\n"
+"  lazy\n"
+"    When true, yield read-only LazyBamRecord views instead of BamRecord\n"
+"    objects. The variable-length fields are then only decoded on first\n"
+"    attribute access, which avoids allocations when only the fixed-size\n"
+"    fields such as flag and position are inspected.\n"
+"  views\n"
+"    When true (implies lazy), the cached _read_name, _seq, _qual and\n"
+"    _tags attributes are read-only memoryview slices into data instead\n"
+"    of bytes copies, so the one block allocation backs the fields of\n"
+"    all its records. The views keep data alive.\n"
+"  recycle\n"
+"    When true, reuse a single BamRecord object for consecutive records.\n"
+"    The caller promises not to keep references to yielded records: a\n"
+"    kept reference observes the record changing in place on the next\n"
+"    iteration. Cannot be combined with lazy.\n"
+"  flag_include\n"
+"    Only yield records that have all of these flag bits set.\n"
+"  flag_exclude\n"
+"    Skip records that have any of these flag bits set.\n"
+"  min_mapq\n"
+"    Skip records with a mapping quality below this value.\n"
+"  region\n"
+"    A (refID, start, end) tuple. Only yield records that overlap the\n"
+"    0-based half-open interval [start, end) on that reference.\n"
+"\n"
+"The filters are evaluated on the raw record bytes; records that are\n"
+"skipped are never materialized, which gives samtools-view-like\n"
+"filtering speed.\n"
+);
+static PyObject *
+bam_iterator(PyObject *module, PyObject *args, PyObject *kwargs) {
+    PyObject * obj = NULL;
+    int lazy = 0;
+    int views = 0;
+    int recycle = 0;
+    unsigned short flag_include = 0;
+    unsigned short flag_exclude = 0;
+    unsigned char min_mapq = 0;
+    PyObject * region = Py_None;
+    char * keywords[] = {"", "lazy", "views", "recycle", "flag_include",
+                         "flag_exclude", "min_mapq", "region", NULL};
+    const char *format = "O|pppHHBO:bam_iterator";
     if (!PyArg_ParseTupleAndKeywords(
-        args, kwargs, "|n:BamBlockBuffer", keywords, &buffersize)) {
-            return -1;
+            args, kwargs, format, keywords, &obj, &lazy, &views, &recycle,
+            &flag_include, &flag_exclude, &min_mapq, &region)) {
+        return NULL;
     }
-    if (buffersize < 0) {
-        PyErr_Format(PyExc_ValueError,
-                     "buffer size must be larger than 0. Got: %ld", buffersize);
-        return -1;
+    lazy = lazy || views;
+    if (lazy && recycle) {
+        PyErr_SetString(PyExc_ValueError,
+                        "lazy and recycle cannot be combined");
+        return NULL;
     }
-    tmp = (char *)PyMem_Malloc(buffersize);
-    if (tmp == NULL) {
-        PyErr_NoMemory();
-        return -1;
+    int32_t region_refID = -1;
+    int64_t region_start = 0;
+    int64_t region_end = 0;
+    if (region != Py_None) {
+        if (!PyArg_ParseTuple(region, "iLL;region must be a "
+                              "(refID, start, end) tuple",
+                              &region_refID, &region_start, &region_end)) {
+            return NULL;
+        }
+        if (region_refID < 0) {
+            PyErr_Format(PyExc_ValueError,
+                         "region refID must not be negative, got %d",
+                         region_refID);
+            return NULL;
+        }
     }
-    self->buffer = tmp;
-    self->buffersize = buffersize;
+    BamIterator *self = PyObject_New(BamIterator, &BamIterator_Type);
+    if (self == NULL) {
+        return NULL;
+    }
+    // PyObject_New does not zero the struct, so initialize the fields the
+    // dealloc reads before any error path can run it.
+    self->view.obj = NULL;
+    self->recycled = NULL;
+    if (PyObject_GetBuffer(obj, &(self->view), PyBUF_SIMPLE) != 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->buf = self->view.buf;
     self->pos = 0;
-    return 0;
+    self->len = self->view.len;
+    self->lazy = lazy;
+    self->views = views;
+    self->recycle = recycle;
+    self->flag_include = flag_include;
+    self->flag_exclude = flag_exclude;
+    self->min_mapq = min_mapq;
+    self->region_refID = region_refID;
+    self->region_start = region_start;
+    self->region_end = region_end;
+    self->filtered = (flag_include || flag_exclude || min_mapq ||
+                      region_refID >= 0);
+    self->records_yielded = 0;
+    return (PyObject *)self;
 }
 
-static PyMemberDef BamBlockBuffer_members[] = {
-    {"buffersize", T_PYSSIZET, offsetof(BamBlockBuffer, buffersize), READONLY,
-     "The size of the internal buffer."},
-    {"bytes_written", T_PYSSIZET, offsetof(BamBlockBuffer, pos), READONLY,
-     "The number of bytes written in the internal buffer."},
-    {NULL}
-};
+PyDoc_STRVAR(decode_sequences_doc,
+"decode_sequences($module, data, /)\n"
+"--\n"
+"\n"
+"Decode the sequences of all BAM records in data in one call.\n"
+"\n"
+"  data\n"
+"    A block of raw BAM Record data. May be any object\n"
+"    that supports the buffer protocol: bytes, bytearray, memoryview.\n"
+"\n"
+"Returns a list with one ASCII string per record. This avoids the\n"
+"per-record attribute access and method call overhead when sequences are\n"
+"extracted for every record in a block.\n"
+);
+static PyObject *
+decode_sequences(PyObject *module, PyObject *obj) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0) {
+        return NULL;
+    }
+    const uint8_t *buf = view.buf;
+    Py_ssize_t len = view.len;
+    PyObject *retval = PyList_New(0);
+    if (retval == NULL) {
+        goto error;
+    }
+    Py_ssize_t pos = 0;
+    while (pos < len) {
+        if ((len - pos) < BAM_PROPERTIES_STRUCT_SIZE) {
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+            goto error;
+        }
+        // The fixed-size fields may start at any alignment inside the
+        // buffer, so they are read with memcpy.
+        uint32_t block_size;
+        uint8_t l_read_name;
+        uint16_t n_cigar_op;
+        uint32_t l_seq;
+        memcpy(&block_size, buf + pos, sizeof(block_size));
+        memcpy(&l_read_name, buf + pos + 12, sizeof(l_read_name));
+        memcpy(&n_cigar_op, buf + pos + 16, sizeof(n_cigar_op));
+        memcpy(&l_seq, buf + pos + 20, sizeof(l_seq));
+        Py_ssize_t record_length = (Py_ssize_t)block_size + 4;
+        Py_ssize_t seq_offset = BAM_PROPERTIES_STRUCT_SIZE + l_read_name +
+                                n_cigar_op * sizeof(uint32_t);
+        if ((pos + record_length > len) ||
+            (seq_offset + ((Py_ssize_t)l_seq + 1) / 2 > record_length)) {
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+            goto error;
+        }
+        PyObject *sequence = decode_bam_sequence(buf + pos + seq_offset,
+                                                 l_seq);
+        if (sequence == NULL) {
+            goto error;
+        }
+        if (PyList_Append(retval, sequence) != 0) {
+            Py_DECREF(sequence);
+            goto error;
+        }
+        Py_DECREF(sequence);
+        pos += record_length;
+    }
+    PyBuffer_Release(&view);
+    return retval;
+error:
+    Py_XDECREF(retval);
+    PyBuffer_Release(&view);
+    return NULL;
+}
 
+/**
+ * @brief Wrap a bytes object in a read-only typed memoryview.
+ *
+ * Steals the reference to bytes_obj. The same construction is used for
+ * the B type tag arrays in tag_ptr_to_pyobject.
+ */
+static PyObject *
+bytes_to_typed_memoryview(PyObject *bytes_obj, char *format, int itemsize)
+{
+    Py_buffer column_view = {
+        .buf = PyBytes_AS_STRING(bytes_obj),
+        .obj = bytes_obj,
+        .len = PyBytes_GET_SIZE(bytes_obj),
+        .itemsize = itemsize,
+        .readonly = 1,
+        .format = format,
+        .ndim = 1,
+        // Fields below are automatically set by PyMemoryView_FromBuffer
+        .shape = NULL,
+        .strides = NULL,
+        .suboffsets = NULL,
+        .internal = NULL,
+    };
+    PyObject *memview = PyMemoryView_FromBuffer(&column_view);
+    if (memview == NULL) {
+        Py_DECREF(bytes_obj);
+        return NULL;
+    }
+    // PyMemoryView_FromBuffer sets this to NULL, but the underlying
+    // object should be properly decreased in reference count.
+    ((PyMemoryViewObject *)memview)->mbuf->master.obj = bytes_obj;
+    return memview;
+}
 
-PyDoc_STRVAR(BamBlockBuffer_write_doc,
-"Write a BamRecord object into the BamBlockBuffer.\n"
+PyDoc_STRVAR(bam_block_to_columns_doc,
+"bam_block_to_columns($module, data, /)\n"
+"--\n"
 "\n"
-"Returns the amount of bytes written. Returns 0 if the BamRecord does not\n"
-"fit in the buffer anymore");
+"Extract the fixed-size fields of all BAM records in data into\n"
+"contiguous per-field arrays.\n"
+"\n"
+"  data\n"
+"    A block of raw BAM Record data. May be any object\n"
+"    that supports the buffer protocol: bytes, bytearray, memoryview.\n"
+"\n"
+"Returns a dict mapping the field names refID, pos, flag, mapq, tlen,\n"
+"l_seq and next_refID to typed memoryviews with one entry per record.\n"
+"The memoryviews can be wrapped zero-copy by numpy.frombuffer. This\n"
+"makes one pass over the block without creating any record objects,\n"
+"which is much faster for statistics over whole files.\n"
+);
+static PyObject *
+bam_block_to_columns(PyObject *module, PyObject *obj) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0) {
+        return NULL;
+    }
+    const uint8_t *buf = view.buf;
+    Py_ssize_t len = view.len;
+    // First pass: count the records so the columns can be allocated at
+    // their exact size.
+    Py_ssize_t number_of_records = 0;
+    Py_ssize_t pos = 0;
+    while (pos < len) {
+        if ((len - pos) < BAM_PROPERTIES_STRUCT_SIZE) {
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+        uint32_t block_size;
+        memcpy(&block_size, buf + pos, sizeof(block_size));
+        Py_ssize_t record_length = (Py_ssize_t)block_size + 4;
+        if (pos + record_length > len) {
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+        number_of_records += 1;
+        pos += record_length;
+    }
+    PyObject *refID_column = PyBytes_FromStringAndSize(
+        NULL, number_of_records * sizeof(int32_t));
+    PyObject *pos_column = PyBytes_FromStringAndSize(
+        NULL, number_of_records * sizeof(int32_t));
+    PyObject *flag_column = PyBytes_FromStringAndSize(
+        NULL, number_of_records * sizeof(uint16_t));
+    PyObject *mapq_column = PyBytes_FromStringAndSize(
+        NULL, number_of_records * sizeof(uint8_t));
+    PyObject *tlen_column = PyBytes_FromStringAndSize(
+        NULL, number_of_records * sizeof(int32_t));
+    PyObject *l_seq_column = PyBytes_FromStringAndSize(
+        NULL, number_of_records * sizeof(uint32_t));
+    PyObject *next_refID_column = PyBytes_FromStringAndSize(
+        NULL, number_of_records * sizeof(int32_t));
+    if (refID_column == NULL || pos_column == NULL || flag_column == NULL ||
+        mapq_column == NULL || tlen_column == NULL || l_seq_column == NULL ||
+        next_refID_column == NULL) {
+        goto error;
+    }
+    int32_t *refIDs = (int32_t *)PyBytes_AS_STRING(refID_column);
+    int32_t *positions = (int32_t *)PyBytes_AS_STRING(pos_column);
+    uint16_t *flags = (uint16_t *)PyBytes_AS_STRING(flag_column);
+    uint8_t *mapqs = (uint8_t *)PyBytes_AS_STRING(mapq_column);
+    int32_t *tlens = (int32_t *)PyBytes_AS_STRING(tlen_column);
+    uint32_t *l_seqs = (uint32_t *)PyBytes_AS_STRING(l_seq_column);
+    int32_t *next_refIDs = (int32_t *)PyBytes_AS_STRING(next_refID_column);
+    // Second pass: sequential writes into the preallocated columns. The
+    // block was validated in the first pass. The fields may start at any
+    // alignment inside the buffer, so they are read with memcpy.
+    pos = 0;
+    for (Py_ssize_t i = 0; i < number_of_records; i += 1) {
+        uint32_t block_size;
+        memcpy(&block_size, buf + pos, sizeof(uint32_t));
+        memcpy(refIDs + i, buf + pos + 4, sizeof(int32_t));
+        memcpy(positions + i, buf + pos + 8, sizeof(int32_t));
+        mapqs[i] = buf[pos + 13];
+        memcpy(flags + i, buf + pos + 18, sizeof(uint16_t));
+        memcpy(l_seqs + i, buf + pos + 20, sizeof(uint32_t));
+        memcpy(next_refIDs + i, buf + pos + 24, sizeof(int32_t));
+        memcpy(tlens + i, buf + pos + 32, sizeof(int32_t));
+        pos += (Py_ssize_t)block_size + 4;
+    }
+    PyBuffer_Release(&view);
+    PyObject *retval = PyDict_New();
+    if (retval == NULL) {
+        view.buf = NULL;
+        goto error;
+    }
+    struct {char *name; PyObject *column; char *format; int itemsize;}
+    columns[] = {
+        {"refID", refID_column, "i", sizeof(int32_t)},
+        {"pos", pos_column, "i", sizeof(int32_t)},
+        {"flag", flag_column, "H", sizeof(uint16_t)},
+        {"mapq", mapq_column, "B", sizeof(uint8_t)},
+        {"tlen", tlen_column, "i", sizeof(int32_t)},
+        {"l_seq", l_seq_column, "I", sizeof(uint32_t)},
+        {"next_refID", next_refID_column, "i", sizeof(int32_t)},
+    };
+    for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); i += 1) {
+        // bytes_to_typed_memoryview steals the column reference.
+        PyObject *memview = bytes_to_typed_memoryview(
+            columns[i].column, columns[i].format, columns[i].itemsize);
+        if (memview == NULL) {
+            // The remaining columns still hold a reference each.
+            for (size_t j = i + 1; j < sizeof(columns) / sizeof(columns[0]);
+                 j += 1) {
+                Py_DECREF(columns[j].column);
+            }
+            Py_DECREF(retval);
+            return NULL;
+        }
+        int ret = PyDict_SetItemString(retval, columns[i].name, memview);
+        Py_DECREF(memview);
+        if (ret != 0) {
+            for (size_t j = i + 1; j < sizeof(columns) / sizeof(columns[0]);
+                 j += 1) {
+                Py_DECREF(columns[j].column);
+            }
+            Py_DECREF(retval);
+            return NULL;
+        }
+    }
+    return retval;
+error:
+    Py_XDECREF(refID_column);
+    Py_XDECREF(pos_column);
+    Py_XDECREF(flag_column);
+    Py_XDECREF(mapq_column);
+    Py_XDECREF(tlen_column);
+    Py_XDECREF(l_seq_column);
+    Py_XDECREF(next_refID_column);
+    if (view.buf != NULL) {
+        PyBuffer_Release(&view);
+    }
+    return NULL;
+}
 
-#define BAMBLOCKBUFFER_WRITE_METHODDEF    \
-    {"write", (PyCFunction)(void(*)(void))BamBlockBuffer_write, METH_O, \
-     BamBlockBuffer_write_doc}
+PyDoc_STRVAR(sort_bam_records_doc,
+"sort_bam_records($module, data, /)\n"
+"--\n"
+"\n"
+"Return the BAM records in data concatenated in coordinate order.\n"
+"\n"
+"  data\n"
+"    A block of raw BAM record data. May be any object\n"
+"    that supports the buffer protocol: bytes, bytearray, memoryview.\n"
+"\n"
+"Records are ordered by a 64-bit refID << 32 | pos key with refID and\n"
+"pos taken as unsigned, so unmapped records (refID -1) sort last. The\n"
+"(key, offset) pairs are radix-sorted and the record bytes are only\n"
+"copied once, in the final gather into the result.\n"
+);
 
-static PyObject * 
-BamBlockBuffer_write(BamBlockBuffer * self, BamRecord * bam_record) {
-    if (Py_TYPE(bam_record) != &BamRecord_Type) {
-        PyErr_Format(PyExc_TypeError, "Type must be BamRecord, got: %s",
-                     Py_TYPE(bam_record)->tp_name);
+typedef struct {
+    uint64_t key;
+    Py_ssize_t offset;
+    Py_ssize_t length;
+} BamSortEntry;
+
+static PyObject *
+sort_bam_records(PyObject *module, PyObject *obj) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0) {
         return NULL;
     }
-    Py_ssize_t record_size = bam_record->block_size + sizeof(bam_record->block_size);
-    Py_ssize_t final_pos = self->pos + record_size;
-    if (final_pos > self->buffersize) {
-        return PyLong_FromSsize_t(0);
+    const uint8_t *buf = view.buf;
+    Py_ssize_t len = view.len;
+    // First pass: count the records so the entries can be allocated at
+    // their exact size.
+    Py_ssize_t number_of_records = 0;
+    Py_ssize_t pos = 0;
+    while (pos < len) {
+        if ((len - pos) < BAM_PROPERTIES_STRUCT_SIZE) {
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+        uint32_t block_size;
+        memcpy(&block_size, buf + pos, sizeof(block_size));
+        Py_ssize_t record_length = (Py_ssize_t)block_size + 4;
+        if (pos + record_length > len) {
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+            PyBuffer_Release(&view);
+            return NULL;
+        }
+        number_of_records += 1;
+        pos += record_length;
     }
-    BamRecord_to_ptr(bam_record, self->buffer + self->pos);
-    self->pos = final_pos;
-    return PyLong_FromSsize_t(record_size);
+    BamSortEntry *entries = PyMem_Malloc(
+        number_of_records * sizeof(BamSortEntry));
+    BamSortEntry *scratch = PyMem_Malloc(
+        number_of_records * sizeof(BamSortEntry));
+    if (entries == NULL || scratch == NULL) {
+        PyMem_Free(entries);
+        PyMem_Free(scratch);
+        PyBuffer_Release(&view);
+        return PyErr_NoMemory();
+    }
+    pos = 0;
+    for (Py_ssize_t i = 0; i < number_of_records; i += 1) {
+        uint32_t block_size;
+        uint32_t refID;
+        uint32_t position;
+        memcpy(&block_size, buf + pos, sizeof(uint32_t));
+        memcpy(&refID, buf + pos + 4, sizeof(uint32_t));
+        memcpy(&position, buf + pos + 8, sizeof(uint32_t));
+        entries[i].key = ((uint64_t)refID << 32) | position;
+        entries[i].offset = pos;
+        entries[i].length = (Py_ssize_t)block_size + 4;
+        pos += entries[i].length;
+    }
+    // LSD radix sort over the keys, one byte at a time, ping-ponging
+    // between entries and scratch. The counting sort per byte is stable,
+    // so records with equal coordinates keep their input order. Passes
+    // where every key has the same byte (common in the high refID bytes)
+    // are skipped.
+    for (int shift = 0; (shift < 64) && (number_of_records > 0); shift += 8) {
+        Py_ssize_t counts[256] = {0};
+        for (Py_ssize_t i = 0; i < number_of_records; i += 1) {
+            counts[(entries[i].key >> shift) & 0xff] += 1;
+        }
+        if (counts[(entries[0].key >> shift) & 0xff] == number_of_records) {
+            continue;
+        }
+        Py_ssize_t offsets[256];
+        Py_ssize_t total = 0;
+        for (int bucket = 0; bucket < 256; bucket += 1) {
+            offsets[bucket] = total;
+            total += counts[bucket];
+        }
+        for (Py_ssize_t i = 0; i < number_of_records; i += 1) {
+            scratch[offsets[(entries[i].key >> shift) & 0xff]] = entries[i];
+            offsets[(entries[i].key >> shift) & 0xff] += 1;
+        }
+        BamSortEntry *tmp = entries;
+        entries = scratch;
+        scratch = tmp;
+    }
+    PyObject *retval = PyBytes_FromStringAndSize(NULL, len);
+    if (retval == NULL) {
+        PyMem_Free(entries);
+        PyMem_Free(scratch);
+        PyBuffer_Release(&view);
+        return PyErr_NoMemory();
+    }
+    char *dest = PyBytes_AS_STRING(retval);
+    Py_ssize_t cursor = 0;
+    for (Py_ssize_t i = 0; i < number_of_records; i += 1) {
+        memcpy(dest + cursor, buf + entries[i].offset, entries[i].length);
+        cursor += entries[i].length;
+    }
+    PyMem_Free(entries);
+    PyMem_Free(scratch);
+    PyBuffer_Release(&view);
+    return retval;
 }
-PyDoc_STRVAR(BamBlockBuffer_reset_doc,
-"Remove all records from the buffer.");
 
-#define BAMBLOCKBUFFER_RESET_METHODDEF    \
-    {"reset", (PyCFunction)(void(*)(void))BamBlockBuffer_reset, METH_NOARGS, \
-     BamBlockBuffer_reset_doc}
+typedef struct {
+    Py_ssize_t name_offset;
+    uint32_t name_length;
+    uint32_t reference_length;
+} BamReferenceEntry;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *data;      // The raw reference block bytes.
+    PyObject *factory;   // Called with (name, length) per item. May be NULL,
+                         // in which case a plain tuple is returned.
+    Py_ssize_t number_of_references;
+    BamReferenceEntry *entries;
+} BamReferenceTable;
+
+static void
+BamReferenceTable_dealloc(BamReferenceTable *self) {
+    Py_CLEAR(self->data);
+    Py_CLEAR(self->factory);
+    PyMem_Free(self->entries);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static Py_ssize_t
+BamReferenceTable_length(BamReferenceTable *self) {
+    return self->number_of_references;
+}
 
 static PyObject *
-BamBlockBuffer_reset(BamBlockBuffer *self, PyObject *Py_UNUSED(ignore)) {
-    self->pos = 0;
-    Py_RETURN_NONE;
+BamReferenceTable_item(BamReferenceTable *self, Py_ssize_t index) {
+    if ((index < 0) || (index >= self->number_of_references)) {
+        PyErr_SetString(PyExc_IndexError, "reference index out of range");
+        return NULL;
+    }
+    BamReferenceEntry *entry = self->entries + index;
+    PyObject *name = PyUnicode_DecodeASCII(
+        PyBytes_AS_STRING(self->data) + entry->name_offset,
+        entry->name_length, "strict");
+    if (name == NULL) {
+        return NULL;
+    }
+    PyObject *length = PyLong_FromUnsignedLong(entry->reference_length);
+    if (length == NULL) {
+        Py_DECREF(name);
+        return NULL;
+    }
+    PyObject *retval;
+    if (self->factory != NULL) {
+        retval = PyObject_CallFunctionObjArgs(
+            self->factory, name, length, NULL);
+    } else {
+        retval = PyTuple_Pack(2, name, length);
+    }
+    Py_DECREF(name);
+    Py_DECREF(length);
+    return retval;
 }
 
-PyDoc_STRVAR(BamBlockBuffer_get_block_view_doc,
-"Return a memoryview over all the memory blocks written so far.");
+static PySequenceMethods BamReferenceTable_as_sequence = {
+    .sq_length = (lenfunc)BamReferenceTable_length,
+    .sq_item = (ssizeargfunc)BamReferenceTable_item,
+};
 
-#define BAMBLOCKBUFFER_GET_BLOCK_VIEW_METHODDEF    \
-    {"get_block_view", (PyCFunction)(void(*)(void))BamBlockBuffer_get_block_view, \
-     METH_NOARGS, BamBlockBuffer_get_block_view_doc}
+PyDoc_STRVAR(BamReferenceTable_doc,
+"A lazy view on the reference table of a BAM file header.\n"
+"\n"
+"Holds the raw reference block plus a compact array of name offsets and\n"
+"lengths. Items are only materialized on subscript, so opening a file\n"
+"with millions of references does not create millions of objects.");
+
+static PyTypeObject BamReferenceTable_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_bam.BamReferenceTable",
+    .tp_basicsize = sizeof(BamReferenceTable),
+    .tp_doc = BamReferenceTable_doc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)BamReferenceTable_dealloc,
+    .tp_as_sequence = &BamReferenceTable_as_sequence,
+};
+
+PyDoc_STRVAR(scan_bam_references_doc,
+"scan_bam_references($module, data, offset, count, /)\n"
+"--\n"
+"\n"
+"Scan up to count complete reference entries in data, starting at\n"
+"offset. Returns an (entries_scanned, end_offset) tuple so the scan can\n"
+"be resumed after more data has been read, without rescanning.\n"
+);
+
+static PyObject *
+scan_bam_references(PyObject *module, PyObject *args) {
+    Py_buffer view;
+    Py_ssize_t offset;
+    Py_ssize_t count;
+    if (!PyArg_ParseTuple(args, "y*nn:scan_bam_references",
+                          &view, &offset, &count)) {
+        return NULL;
+    }
+    const uint8_t *buf = view.buf;
+    Py_ssize_t len = view.len;
+    Py_ssize_t scanned = 0;
+    Py_ssize_t pos = offset;
+    while (scanned < count) {
+        if ((len - pos) < (Py_ssize_t)sizeof(uint32_t)) {
+            break;
+        }
+        uint32_t l_name;
+        memcpy(&l_name, buf + pos, sizeof(l_name));
+        // l_name, the name itself and l_ref.
+        Py_ssize_t entry_length = 2 * sizeof(uint32_t) + (Py_ssize_t)l_name;
+        if ((len - pos) < entry_length) {
+            break;
+        }
+        pos += entry_length;
+        scanned += 1;
+    }
+    PyBuffer_Release(&view);
+    return Py_BuildValue("(nn)", scanned, pos);
+}
+
+PyDoc_STRVAR(parse_bam_references_doc,
+"parse_bam_references($module, data, number_of_references, factory=None, /)\n"
+"--\n"
+"\n"
+"Parse a BAM reference block into a lazy BamReferenceTable.\n"
+"\n"
+"  data\n"
+"    A bytes object with the raw reference block.\n"
+"  number_of_references\n"
+"    The n_ref count preceding the block in the file.\n"
+"  factory\n"
+"    Called with (name, length) when an item is subscripted, for\n"
+"    example the BamReference named tuple. When None a plain tuple\n"
+"    is returned.\n"
+"\n"
+"One pass records the name offsets and lengths in a compact array, no\n"
+"per-reference objects are created until the table is subscripted.\n"
+);
 
 static PyObject *
-BamBlockBuffer_get_block_view(BamBlockBuffer *self, PyObject *Py_UNUSED(ignore)) {
-    return PyMemoryView_FromMemory(self->buffer, self->pos, PyBUF_READ);
+parse_bam_references(PyObject *module, PyObject *args) {
+    PyObject *data;
+    Py_ssize_t number_of_references;
+    PyObject *factory = Py_None;
+    if (!PyArg_ParseTuple(args, "Sn|O:parse_bam_references",
+                          &data, &number_of_references, &factory)) {
+        return NULL;
+    }
+    const uint8_t *buf = (uint8_t *)PyBytes_AS_STRING(data);
+    Py_ssize_t len = PyBytes_GET_SIZE(data);
+    BamReferenceEntry *entries = PyMem_Malloc(
+        number_of_references * sizeof(BamReferenceEntry));
+    if (entries == NULL) {
+        return PyErr_NoMemory();
+    }
+    Py_ssize_t pos = 0;
+    for (Py_ssize_t i = 0; i < number_of_references; i += 1) {
+        uint32_t l_name;
+        if ((len - pos) < (Py_ssize_t)sizeof(uint32_t)) {
+            PyMem_Free(entries);
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM reference table");
+            return NULL;
+        }
+        memcpy(&l_name, buf + pos, sizeof(l_name));
+        Py_ssize_t entry_length = 2 * sizeof(uint32_t) + (Py_ssize_t)l_name;
+        if ((len - pos) < entry_length) {
+            PyMem_Free(entries);
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM reference table");
+            return NULL;
+        }
+        entries[i].name_offset = pos + sizeof(uint32_t);
+        entries[i].name_length = l_name;
+        memcpy(&entries[i].reference_length,
+               buf + pos + sizeof(uint32_t) + l_name, sizeof(uint32_t));
+        pos += entry_length;
+    }
+    BamReferenceTable *table = PyObject_New(
+        BamReferenceTable, &BamReferenceTable_Type);
+    if (table == NULL) {
+        PyMem_Free(entries);
+        return NULL;
+    }
+    Py_INCREF(data);
+    table->data = data;
+    if (factory == Py_None) {
+        table->factory = NULL;
+    } else {
+        Py_INCREF(factory);
+        table->factory = factory;
+    }
+    table->number_of_references = number_of_references;
+    table->entries = entries;
+    return (PyObject *)table;
 }
 
-static PyMethodDef BamBlockBuffer_methods[] = {
-    BAMBLOCKBUFFER_WRITE_METHODDEF,
-    BAMBLOCKBUFFER_RESET_METHODDEF,
-    BAMBLOCKBUFFER_GET_BLOCK_VIEW_METHODDEF,
-    {NULL},
-};
-
-static PyTypeObject BamBlockBuffer_Type = {
-    .tp_name = "_bam.BamBlockBuffer",
-    .tp_basicsize = sizeof(BamBlockBuffer),
-    .tp_dealloc = (destructor)BamBlockBuffer_dealloc,
-    .tp_init = (initproc)BamBlockBuffer__init__,
-    .tp_new = PyType_GenericNew,
-    .tp_doc = BamBlockBuffer__doc__,
-    .tp_members = BamBlockBuffer_members,
-    .tp_methods = BamBlockBuffer_methods,
-};
+typedef struct {
+    PyObject *iterator;       // Iterator over raw BAM block buffers.
+    PyObject *buffer;         // Bytes object holding unconsumed data.
+    Py_ssize_t pos;           // Start of the next record in buffer.
+    Py_ssize_t record_length; // 4 + block_size of the next record.
+    uint64_t key;             // (refID << 32) | pos of the next record.
+    uint16_t flag;
+    int exhausted;
+} BamMergeInput;
 
 typedef struct {
-    PyObject_HEAD 
-    Py_buffer view; 
-    char * buf;
-    Py_ssize_t pos;
-    Py_ssize_t len; 
-} BamIterator;
+    PyObject_HEAD
+    BamMergeInput *inputs;    // tree_leaves entries, padded with exhausted
+                              // sentinels up to a power of two.
+    Py_ssize_t number_of_inputs;
+    Py_ssize_t tree_leaves;
+    Py_ssize_t *tree;         // Tournament tree of input indices. The root
+                              // at tree[1] is the input with the smallest
+                              // next record; leaves start at tree_leaves.
+} BamMergeIterator;
 
-static void
-BamIterator_dealloc(BamIterator *self) {
-    PyBuffer_Release(&(self->view));
-    Py_TYPE(self)->tp_free((PyObject *)self);
+/**
+ * @brief Decode the sort key of the record at input->pos, pulling more
+ *        blocks from the iterator until a complete record is buffered.
+ *
+ * Consumes the previous record first. Sets input->exhausted when the
+ * iterator is cleanly exhausted at a record boundary.
+ *
+ * @return 0 on success, -1 with an exception set on failure.
+ */
+static int
+merge_input_advance(BamMergeInput *input)
+{
+    input->pos += input->record_length;
+    input->record_length = 0;
+    while (1) {
+        Py_ssize_t available = PyBytes_GET_SIZE(input->buffer) - input->pos;
+        if (available >= BAM_PROPERTIES_STRUCT_SIZE) {
+            const uint8_t *record =
+                (uint8_t *)PyBytes_AS_STRING(input->buffer) + input->pos;
+            uint32_t block_size;
+            memcpy(&block_size, record, sizeof(block_size));
+            Py_ssize_t record_length = (Py_ssize_t)block_size + 4;
+            if (record_length <= available) {
+                uint32_t refID;
+                uint32_t position;
+                memcpy(&refID, record + 4, sizeof(uint32_t));
+                memcpy(&position, record + 8, sizeof(uint32_t));
+                memcpy(&input->flag, record + 18, sizeof(uint16_t));
+                input->key = ((uint64_t)refID << 32) | position;
+                input->record_length = record_length;
+                return 0;
+            }
+        }
+        PyObject *block = PyIter_Next(input->iterator);
+        if (block == NULL) {
+            if (PyErr_Occurred()) {
+                return -1;
+            }
+            if (available != 0) {
+                PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+                return -1;
+            }
+            input->exhausted = 1;
+            return 0;
+        }
+        Py_buffer view;
+        if (PyObject_GetBuffer(block, &view, PyBUF_SIMPLE) != 0) {
+            Py_DECREF(block);
+            return -1;
+        }
+        if ((available == 0) && (view.len > 0) && PyBytes_CheckExact(block)) {
+            // Common case: nothing carried over and the block is already a
+            // bytes object, so it can be adopted without copying.
+            PyBuffer_Release(&view);
+            Py_SETREF(input->buffer, block);
+            input->pos = 0;
+            continue;
+        }
+        PyObject *new_buffer = PyBytes_FromStringAndSize(
+            NULL, available + view.len);
+        if (new_buffer == NULL) {
+            PyBuffer_Release(&view);
+            Py_DECREF(block);
+            return -1;
+        }
+        char *dest = PyBytes_AS_STRING(new_buffer);
+        memcpy(dest, PyBytes_AS_STRING(input->buffer) + input->pos,
+               available);
+        memcpy(dest + available, view.buf, view.len);
+        PyBuffer_Release(&view);
+        Py_DECREF(block);
+        Py_SETREF(input->buffer, new_buffer);
+        input->pos = 0;
+    }
 }
 
-static BamIterator *
-BamIterator_iter(BamIterator *self){
-    Py_INCREF(self);
-    return self;
+/**
+ * @brief Does input a sort before input b? Compares (refID, pos) then flag
+ *        straight from the decoded keys; ties keep the lower input index,
+ *        so the merge is stable across inputs.
+ */
+static inline int
+merge_input_less(const BamMergeInput *inputs, Py_ssize_t a, Py_ssize_t b)
+{
+    const BamMergeInput *input_a = inputs + a;
+    const BamMergeInput *input_b = inputs + b;
+    if (input_b->exhausted) {
+        return !input_a->exhausted;
+    }
+    if (input_a->exhausted) {
+        return 0;
+    }
+    if (input_a->key != input_b->key) {
+        return input_a->key < input_b->key;
+    }
+    if (input_a->flag != input_b->flag) {
+        return input_a->flag < input_b->flag;
+    }
+    return a < b;
+}
+
+static void
+BamMergeIterator_dealloc(BamMergeIterator *self)
+{
+    if (self->inputs != NULL) {
+        for (Py_ssize_t i = 0; i < self->tree_leaves; i += 1) {
+            Py_XDECREF(self->inputs[i].iterator);
+            Py_XDECREF(self->inputs[i].buffer);
+        }
+        PyMem_Free(self->inputs);
+    }
+    PyMem_Free(self->tree);
+    Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
 static PyObject *
-BamIterator_iternext(BamIterator *self){
-    if (self->pos >= self->len){
-        PyErr_SetNone(PyExc_StopIteration);
+BamMergeIterator_next(BamMergeIterator *self)
+{
+    Py_ssize_t winner = self->tree[1];
+    BamMergeInput *input = self->inputs + winner;
+    if (input->exhausted) {
         return NULL;
     }
-    Py_ssize_t start_pos = self->pos;
-
-    BamRecord * bam_record = PyObject_New(BamRecord, &BamRecord_Type);
-    bam_record->read_name = NULL;
-    bam_record->seq = NULL;
-    bam_record->bamcigar = NULL;
-    bam_record->qual = NULL;
-    bam_record->tags = NULL;
-
-    if ((self->len - self->pos) < BAM_PROPERTIES_STRUCT_SIZE) {
-        PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
-        Py_DECREF(bam_record);
+    PyObject *record = PyBytes_FromStringAndSize(
+        PyBytes_AS_STRING(input->buffer) + input->pos, input->record_length);
+    if (record == NULL) {
         return NULL;
     }
-    // Copy the bam file data directly into the struct.
-    memcpy((char *)bam_record + BAM_PROPERTIES_STRUCT_START,
-            self->buf + self->pos,
-            BAM_PROPERTIES_STRUCT_SIZE);
-
-    // Block_size is excluding the block_size field it self.
-    Py_ssize_t record_length = bam_record->block_size + 4;
-    if (self->pos + record_length > self->len) {
-        PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
-        Py_DECREF(bam_record);
+    if (merge_input_advance(input) != 0) {
+        Py_DECREF(record);
         return NULL;
     }
-    self->pos += BAM_PROPERTIES_STRUCT_SIZE;
-    bam_record->read_name = PyBytes_FromStringAndSize(
-        self->buf + self->pos, bam_record->l_read_name -1);
-    self->pos += bam_record->l_read_name;
-
-    Py_ssize_t cigar_length = bam_record->n_cigar_op * sizeof(uint32_t);
-    bam_record->bamcigar = BamCigar_FromPointerAndSize(
-        (uint32_t *)(self->buf + self->pos), bam_record->n_cigar_op);
-    self->pos += cigar_length;
+    // Replay the matches on the path from the winner's leaf to the root:
+    // the only comparisons whose outcome can have changed.
+    for (Py_ssize_t node = (self->tree_leaves + winner) >> 1; node >= 1;
+            node >>= 1) {
+        Py_ssize_t left = self->tree[2 * node];
+        Py_ssize_t right = self->tree[2 * node + 1];
+        self->tree[node] =
+            merge_input_less(self->inputs, left, right) ? left : right;
+    }
+    return record;
+}
 
-    Py_ssize_t seq_length = (bam_record->l_seq + 1) / 2;
-    bam_record->seq = PyBytes_FromStringAndSize(
-        self->buf + self->pos, seq_length);
-    self->pos += seq_length;
+PyDoc_STRVAR(BamMergeIterator_doc,
+"Iterator that merges multiple streams of raw BAM blocks into one sorted\n"
+"stream of raw record buffers. Created by merge_bam_records.");
 
-    bam_record->qual = PyBytes_FromStringAndSize(
-        self->buf + self->pos, bam_record->l_seq);
-    self->pos += bam_record->l_seq;
+static PyTypeObject BamMergeIterator_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_bam.BamMergeIterator",
+    .tp_basicsize = sizeof(BamMergeIterator),
+    .tp_doc = BamMergeIterator_doc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor)BamMergeIterator_dealloc,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc)BamMergeIterator_next,
+};
 
-    // Tags are in the remaining block of data.
-    Py_ssize_t tags_length = start_pos + record_length - self->pos;
-    bam_record->tags = PyBytes_FromStringAndSize(
-        self->buf + self-> pos, tags_length);
-    
-    // Should be equal to record_length
-    self->pos += tags_length;
+PyDoc_STRVAR(merge_bam_records_doc,
+"merge_bam_records($module, iterables, /)\n"
+"--\n"
+"\n"
+"Merge coordinate-sorted streams of raw BAM blocks into one stream of\n"
+"raw records. Takes a sequence of iterables that yield raw BAM block\n"
+"buffers (such as BGZFReader objects) and yields one bytes object per\n"
+"record, smallest (refID, pos, flag) first, without materializing any\n"
+"BamRecord objects. The comparisons happen in a tournament tree, so\n"
+"each yielded record costs log2(number_of_inputs) comparisons.");
 
-    // Check if any of the bytes objects was NULL. This means there was 
-    // no memory available.
-    if ((bam_record->read_name == NULL) | (bam_record->tags == NULL) |
-        (bam_record->seq == NULL) | (bam_record->qual == NULL) |
-        (bam_record->tags == NULL)) {
-        Py_DECREF(bam_record);
+static PyObject *
+merge_bam_records(PyObject *module, PyObject *iterables)
+{
+    PyObject *sequence = PySequence_Fast(
+        iterables, "iterables must be a sequence of iterables");
+    if (sequence == NULL) {
+        return NULL;
+    }
+    Py_ssize_t number_of_inputs = PySequence_Fast_GET_SIZE(sequence);
+    // Pad the leaves to a power of two (at least two), so every internal
+    // tree node has exactly two children.
+    Py_ssize_t tree_leaves = 2;
+    while (tree_leaves < number_of_inputs) {
+        tree_leaves *= 2;
+    }
+    BamMergeIterator *iterator = PyObject_New(
+        BamMergeIterator, &BamMergeIterator_Type);
+    if (iterator == NULL) {
+        Py_DECREF(sequence);
+        return NULL;
+    }
+    iterator->number_of_inputs = number_of_inputs;
+    iterator->tree_leaves = tree_leaves;
+    iterator->inputs = PyMem_Calloc(tree_leaves, sizeof(BamMergeInput));
+    iterator->tree = PyMem_Malloc(2 * tree_leaves * sizeof(Py_ssize_t));
+    if (iterator->inputs == NULL || iterator->tree == NULL) {
+        Py_DECREF(sequence);
+        Py_DECREF(iterator);
         return PyErr_NoMemory();
     }
-
-    return (PyObject *)bam_record;
+    for (Py_ssize_t i = 0; i < tree_leaves; i += 1) {
+        BamMergeInput *input = iterator->inputs + i;
+        input->buffer = PyBytes_FromStringAndSize(NULL, 0);
+        if (input->buffer == NULL) {
+            Py_DECREF(sequence);
+            Py_DECREF(iterator);
+            return NULL;
+        }
+        if (i >= number_of_inputs) {
+            // Padding leaf: permanently exhausted.
+            input->exhausted = 1;
+            continue;
+        }
+        input->iterator = PyObject_GetIter(
+            PySequence_Fast_GET_ITEM(sequence, i));
+        if (input->iterator == NULL) {
+            Py_DECREF(sequence);
+            Py_DECREF(iterator);
+            return NULL;
+        }
+        if (merge_input_advance(input) != 0) {
+            Py_DECREF(sequence);
+            Py_DECREF(iterator);
+            return NULL;
+        }
+    }
+    Py_DECREF(sequence);
+    for (Py_ssize_t i = 0; i < tree_leaves; i += 1) {
+        iterator->tree[tree_leaves + i] = i;
+    }
+    for (Py_ssize_t node = tree_leaves - 1; node >= 1; node -= 1) {
+        Py_ssize_t left = iterator->tree[2 * node];
+        Py_ssize_t right = iterator->tree[2 * node + 1];
+        iterator->tree[node] =
+            merge_input_less(iterator->inputs, left, right) ? left : right;
+    }
+    return (PyObject *)iterator;
 }
 
-static PyTypeObject BamIterator_Type = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    .tp_name = "_bam.BamIterator", 
-    .tp_basicsize = sizeof(BamIterator),
-    .tp_dealloc =(destructor)BamIterator_dealloc,  
-    .tp_flags = Py_TPFLAGS_DEFAULT,
-    .tp_iter = (getiterfunc)BamIterator_iter,
-    .tp_iternext = (iternextfunc)BamIterator_iternext
-};
+PyDoc_STRVAR(cigars_to_strings_doc,
+"cigars_to_strings($module, cigars, /)\n"
+"--\n"
+"\n"
+"Format a batch of Cigar objects into a list of strings. One scratch\n"
+"buffer sized for the largest cigar is reused for the whole batch, so\n"
+"converting many records to SAM text does not allocate per cigar.");
 
-PyDoc_STRVAR(bam_iterator_doc,
-"bam_iterator($module, data, /)\n"
+static PyObject *
+cigars_to_strings(PyObject *module, PyObject *cigars)
+{
+    PyObject *sequence = PySequence_Fast(
+        cigars, "cigars must be a sequence of Cigar objects");
+    if (sequence == NULL) {
+        return NULL;
+    }
+    Py_ssize_t number_of_cigars = PySequence_Fast_GET_SIZE(sequence);
+    Py_ssize_t max_cigar_ops = 0;
+    for (Py_ssize_t i = 0; i < number_of_cigars; i += 1) {
+        PyObject *item = PySequence_Fast_GET_ITEM(sequence, i);
+        if (!PyObject_IsInstance(item, (PyObject *)&BamCigar_Type)) {
+            PyErr_Format(PyExc_TypeError,
+                         "cigars must contain only Cigar objects, "
+                         "got %s", Py_TYPE(item)->tp_name);
+            Py_DECREF(sequence);
+            return NULL;
+        }
+        if (Py_SIZE(item) > max_cigar_ops) {
+            max_cigar_ops = Py_SIZE(item);
+        }
+    }
+    char *buffer = PyMem_Malloc(max_cigar_ops * 10);
+    if (buffer == NULL && max_cigar_ops > 0) {
+        Py_DECREF(sequence);
+        return PyErr_NoMemory();
+    }
+    PyObject *retval = PyList_New(number_of_cigars);
+    if (retval == NULL) {
+        PyMem_Free(buffer);
+        Py_DECREF(sequence);
+        return NULL;
+    }
+    for (Py_ssize_t i = 0; i < number_of_cigars; i += 1) {
+        BamCigar *item = (BamCigar *)PySequence_Fast_GET_ITEM(sequence, i);
+        Py_ssize_t string_size = format_cigar(
+            item->cigar, Py_SIZE(item), buffer);
+        PyObject *cigar_string = PyUnicode_New(string_size, 127);
+        if (cigar_string == NULL) {
+            PyMem_Free(buffer);
+            Py_DECREF(sequence);
+            Py_DECREF(retval);
+            return NULL;
+        }
+        memcpy(PyUnicode_1BYTE_DATA(cigar_string), buffer, string_size);
+        PyList_SET_ITEM(retval, i, cigar_string);
+    }
+    PyMem_Free(buffer);
+    Py_DECREF(sequence);
+    return retval;
+}
+
+PyDoc_STRVAR(bam_block_to_sam_doc,
+"bam_block_to_sam($module, data, references, /)\n"
 "--\n"
 "\n"
-"Return an iterator that yields BamRecord objects.\n"
+"Format a block of raw BAM record data as SAM text.\n"
 "\n"
 "  data\n"
-"    A block of raw BAM Record data. May be any object\n"
+"    A block of raw BAM record data. May be any object\n"
 "    that supports the buffer protocol: bytes, bytearray, memoryview.\n"
-);
-static PyObject * 
-bam_iterator(PyObject *module, PyObject * obj) {
-    BamIterator *self = PyObject_New(BamIterator, &BamIterator_Type);
-    if (!PyObject_GetBuffer(obj, &(self->view), PyBUF_SIMPLE) == 0) {
-        Py_DECREF(self);
+"  references\n"
+"    A sequence of reference name strings. The refID and next_refID\n"
+"    fields index into this sequence for the RNAME and RNEXT columns.\n"
+"\n"
+"Returns one string with a newline-terminated SAM line per record, so a\n"
+"whole block can be written to a file in a single call.");
+
+static PyObject *
+bam_block_to_sam(PyObject *module, PyObject *args)
+{
+    PyObject *data = NULL;
+    PyObject *references_obj = NULL;
+    if (!PyArg_ParseTuple(args, "OO:bam_block_to_sam",
+                          &data, &references_obj)) {
         return NULL;
     }
-    self->buf = self->view.buf;
-    self->pos = 0;
-    self->len = self->view.len;
-    return (PyObject *)self;
+    Py_buffer view;
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) != 0) {
+        return NULL;
+    }
+    PyObject *sequence = PySequence_Fast(
+        references_obj, "references must be a sequence of strings");
+    if (sequence == NULL) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    SamReference *references = sam_references_resolve(sequence);
+    if (references == NULL) {
+        Py_DECREF(sequence);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    Py_ssize_t number_of_references = PySequence_Fast_GET_SIZE(sequence);
+    const uint8_t *buf = view.buf;
+    Py_ssize_t len = view.len;
+    // First pass: validate the records and compute one upper bound for
+    // the entire text, so the buffer never has to be resized.
+    Py_ssize_t total_bound = 0;
+    Py_ssize_t pos = 0;
+    while (pos < len) {
+        if ((len - pos) < BAM_PROPERTIES_STRUCT_SIZE) {
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+            goto error;
+        }
+        uint32_t block_size;
+        memcpy(&block_size, buf + pos, sizeof(block_size));
+        Py_ssize_t record_length = (Py_ssize_t)block_size + 4;
+        if (pos + record_length > len) {
+            PyErr_SetString(PyExc_EOFError, "Truncated BAM record");
+            goto error;
+        }
+        Py_ssize_t bound = sam_record_size_bound(
+            buf + pos, record_length, references, number_of_references);
+        if (bound < 0) {
+            goto error;
+        }
+        total_bound += bound + 1;  // Plus the newline.
+        pos += record_length;
+    }
+    char *buffer = PyMem_Malloc(total_bound);
+    if (buffer == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    Py_ssize_t cursor = 0;
+    pos = 0;
+    while (pos < len) {
+        uint32_t block_size;
+        memcpy(&block_size, buf + pos, sizeof(block_size));
+        Py_ssize_t record_length = (Py_ssize_t)block_size + 4;
+        Py_ssize_t line_size = sam_record_format(
+            buf + pos, record_length, references, buffer + cursor);
+        if (line_size < 0) {
+            PyMem_Free(buffer);
+            goto error;
+        }
+        cursor += line_size;
+        buffer[cursor] = '\n'; cursor += 1;
+        pos += record_length;
+    }
+    PyObject *retval = PyUnicode_New(cursor, 127);
+    if (retval == NULL) {
+        PyMem_Free(buffer);
+        PyErr_NoMemory();
+        goto error;
+    }
+    memcpy(PyUnicode_1BYTE_DATA(retval), buffer, cursor);
+    PyMem_Free(buffer);
+    PyMem_Free(references);
+    Py_DECREF(sequence);
+    PyBuffer_Release(&view);
+    return retval;
+error:
+    PyMem_Free(references);
+    Py_DECREF(sequence);
+    PyBuffer_Release(&view);
+    return NULL;
 }
 
 static PyMethodDef _bam_methods[] = {
     {"bam_iterator", (PyCFunction)(void(*)(void))bam_iterator,
-     METH_O, bam_iterator_doc},
+     METH_VARARGS | METH_KEYWORDS, bam_iterator_doc},
+    {"decode_sequences", (PyCFunction)(void(*)(void))decode_sequences,
+     METH_O, decode_sequences_doc},
+    {"bam_block_to_columns", (PyCFunction)(void(*)(void))bam_block_to_columns,
+     METH_O, bam_block_to_columns_doc},
+    {"sort_bam_records", (PyCFunction)(void(*)(void))sort_bam_records,
+     METH_O, sort_bam_records_doc},
+    {"bam_block_to_sam", (PyCFunction)(void(*)(void))bam_block_to_sam,
+     METH_VARARGS, bam_block_to_sam_doc},
+    {"cigars_to_strings", (PyCFunction)(void(*)(void))cigars_to_strings,
+     METH_O, cigars_to_strings_doc},
+    {"merge_bam_records", (PyCFunction)(void(*)(void))merge_bam_records,
+     METH_O, merge_bam_records_doc},
+    {"scan_bam_references", (PyCFunction)(void(*)(void))scan_bam_references,
+     METH_VARARGS, scan_bam_references_doc},
+    {"parse_bam_references", (PyCFunction)(void(*)(void))parse_bam_references,
+     METH_VARARGS, parse_bam_references_doc},
     {NULL}
 };
 
@@ -2042,6 +5437,23 @@ PyInit__bam(void)
     if (m == NULL)
         return NULL;
 
+#ifdef BUILD_SIMD_NIBBLE_DECODE
+    // Runtime CPU dispatch for the sequence decoding kernel.
+    if (__builtin_cpu_supports("avx2")) {
+        decode_nibbles = decode_nibbles_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        decode_nibbles = decode_nibbles_ssse3;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        encode_nibbles = encode_nibbles_ssse3;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        shift_bytes_range_checked = shift_bytes_range_checked_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        shift_bytes_range_checked = shift_bytes_range_checked_sse2;
+    }
+#endif
+
     if (PyType_Ready(&BamIterator_Type) < 0)
         return NULL;
     PyObject * BamiteratorType = (PyObject *)&BamIterator_Type;
@@ -2049,6 +5461,20 @@ PyInit__bam(void)
     if (PyModule_AddObject(m, "BamIterator", BamiteratorType) < 0)
         return NULL;
 
+    if (PyType_Ready(&BamReferenceTable_Type) < 0)
+        return NULL;
+    PyObject * BamReferenceTableType = (PyObject *)&BamReferenceTable_Type;
+    Py_INCREF(BamReferenceTableType);
+    if (PyModule_AddObject(m, "BamReferenceTable", BamReferenceTableType) < 0)
+        return NULL;
+
+    if (PyType_Ready(&BamMergeIterator_Type) < 0)
+        return NULL;
+    PyObject * BamMergeIteratorType = (PyObject *)&BamMergeIterator_Type;
+    Py_INCREF(BamMergeIteratorType);
+    if (PyModule_AddObject(m, "BamMergeIterator", BamMergeIteratorType) < 0)
+        return NULL;
+
     if (PyType_Ready(&BamRecord_Type) < 0)
         return NULL;
     PyObject * BamRecordType = (PyObject *)&BamRecord_Type;
@@ -2057,6 +5483,14 @@ PyInit__bam(void)
         return NULL;
     }
 
+    if (PyType_Ready(&LazyBamRecord_Type) < 0)
+        return NULL;
+    PyObject * LazyBamRecordType = (PyObject *)&LazyBamRecord_Type;
+    Py_INCREF(LazyBamRecordType);
+    if (PyModule_AddObject(m, "LazyBamRecord", LazyBamRecordType) < 0) {
+        return NULL;
+    }
+
     if (PyType_Ready(&BamBlockBuffer_Type) < 0)
         return NULL;
     PyObject * BamBlockBufferType = (PyObject *)&BamBlockBuffer_Type;
@@ -0,0 +1,379 @@
+// Copyright (c) 2022 Ruben Vorderman
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to
+// deal in the Software without restriction, including without limitation the
+// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+// sell copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "stdint.h"
+#include <zlib.h>
+
+#define BGZF_MAX_BLOCK_SIZE 0x10000  // 64K, 65536. Same as bgzf.h
+#define BGZF_BLOCK_SIZE 0xff00  // 65280. Same as bgzf.h
+
+// The gzip FLG bit signalling the presence of extra fields. BGZF stores its
+// BSIZE field in such an extra field.
+#define GZIP_FEXTRA 4
+
+static PyObject *BGZFError;  // Initialized in the module init function.
+
+// Error codes for work that is done while the GIL is released. A Python
+// exception can only be set after the GIL has been reacquired.
+#define BGZF_OK 0
+#define BGZF_ZLIB_INIT_ERROR 1
+#define BGZF_INFLATE_ERROR 2
+#define BGZF_CRC_ERROR 3
+
+/**
+ * @brief Inflate one raw deflate stream and verify its checksum.
+ *
+ * Runs without touching any Python objects so it can be called with the GIL
+ * released.
+ *
+ * @param compressed Pointer to the raw deflate data.
+ * @param compressed_length Length of the raw deflate data.
+ * @param dest Destination buffer. Must hold exactly isize bytes.
+ * @param isize The expected decompressed size from the BGZF trailer.
+ * @param crc The expected CRC32 from the BGZF trailer.
+ * @return int One of the BGZF_* error codes.
+ */
+static int
+inflate_block(const uint8_t *compressed, Py_ssize_t compressed_length,
+              uint8_t *dest, uint32_t isize, uint32_t crc)
+{
+    z_stream zst;
+    memset(&zst, 0, sizeof(z_stream));
+    // Negative wbits for a raw deflate stream without gzip/zlib headers.
+    if (inflateInit2(&zst, -MAX_WBITS) != Z_OK) {
+        return BGZF_ZLIB_INIT_ERROR;
+    }
+    zst.next_in = (uint8_t *)compressed;
+    zst.avail_in = (uInt)compressed_length;
+    zst.next_out = dest;
+    zst.avail_out = isize;
+    int ret = inflate(&zst, Z_FINISH);
+    inflateEnd(&zst);
+    // The output must be completely filled and the input completely used,
+    // otherwise ISIZE from the trailer did not match the actual data.
+    if ((ret != Z_STREAM_END) || (zst.avail_out != 0) || (zst.avail_in != 0)) {
+        return BGZF_INFLATE_ERROR;
+    }
+    if (crc32(0, dest, isize) != crc) {
+        return BGZF_CRC_ERROR;
+    }
+    return BGZF_OK;
+}
+
+PyDoc_STRVAR(bgzf_decompress_block__doc__,
+"decompress_block($module, block, /)\n"
+"--\n"
+"\n"
+"Decompress a single raw BGZF block and return the decompressed bytes.\n"
+"\n"
+"  block\n"
+"    One complete BGZF block including the gzip header and trailer. May be\n"
+"    any object that supports the buffer protocol.\n"
+"\n"
+"The gzip header is validated, the deflate data is decompressed and the\n"
+"CRC32 and ISIZE fields from the trailer are checked. The GIL is released\n"
+"during decompression so multiple blocks can be decompressed in parallel\n"
+"from a worker-thread pool.\n"
+);
+
+#define BGZF_DECOMPRESS_BLOCK_METHODDEF    \
+    {"decompress_block", (PyCFunction)(void(*)(void))bgzf_decompress_block, \
+     METH_O, bgzf_decompress_block__doc__}
+
+static PyObject *
+bgzf_decompress_block(PyObject *module, PyObject *obj)
+{
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0) {
+        return NULL;
+    }
+    const uint8_t *block = view.buf;
+    Py_ssize_t block_length = view.len;
+    // Smallest possible BGZF block: 12-byte gzip header, 6-byte BC extra
+    // field, 2-byte empty deflate stream and an 8-byte trailer.
+    if (block_length < 28) {
+        PyErr_Format(BGZFError, "Truncated BGZF block: %zd bytes.",
+                     block_length);
+        goto error;
+    }
+    if (!((block[0] == 0x1f) && (block[1] == 0x8b))) {
+        PyErr_SetString(BGZFError, "Invalid gzip block: magic not found.");
+        goto error;
+    }
+    if (block[2] != 8) {
+        PyErr_Format(BGZFError, "Unsupported compression method: %d.",
+                     block[2]);
+        goto error;
+    }
+    if (!(block[3] & GZIP_FEXTRA)) {
+        PyErr_SetString(BGZFError,
+                        "Gzip block should contain an extra field.");
+        goto error;
+    }
+    uint16_t xlen = block[10] | (block[11] << 8);
+    if ((Py_ssize_t)(12 + xlen + 8) > block_length) {
+        PyErr_SetString(BGZFError, "Truncated BGZF block: XLEN too large.");
+        goto error;
+    }
+    // Find the BC subfield that holds BSIZE. It is usually the first and
+    // only extra subfield, but the spec does not require that.
+    const uint8_t *subfield = block + 12;
+    const uint8_t *subfield_end = subfield + xlen;
+    Py_ssize_t bsize = -1;
+    while (subfield + 4 <= subfield_end) {
+        uint16_t subfield_length = subfield[2] | (subfield[3] << 8);
+        if ((subfield[0] == 66) && (subfield[1] == 67) &&
+            (subfield_length == 2)) {
+            if (subfield + 6 > subfield_end) {
+                break;
+            }
+            bsize = subfield[4] | (subfield[5] << 8);
+            break;
+        }
+        subfield += 4 + subfield_length;
+    }
+    if (bsize == -1) {
+        PyErr_SetString(BGZFError, "No BSIZE field found in BGZF block.");
+        goto error;
+    }
+    if (bsize + 1 != block_length) {
+        PyErr_Format(BGZFError,
+                     "BSIZE (%zd) does not match the block length (%zd).",
+                     bsize + 1, block_length);
+        goto error;
+    }
+    const uint8_t *compressed = block + 12 + xlen;
+    Py_ssize_t compressed_length = block_length - (12 + xlen) - 8;
+    const uint8_t *trailer = block + block_length - 8;
+    uint32_t crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) |
+                   ((uint32_t)trailer[3] << 24);
+    uint32_t isize = trailer[4] | (trailer[5] << 8) | (trailer[6] << 16) |
+                     ((uint32_t)trailer[7] << 24);
+    if (isize > BGZF_MAX_BLOCK_SIZE) {
+        PyErr_Format(BGZFError,
+                     "ISIZE (%u) larger than maximum BGZF block size.",
+                     isize);
+        goto error;
+    }
+    PyObject *retval = PyBytes_FromStringAndSize(NULL, isize);
+    if (retval == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    int ret;
+    Py_BEGIN_ALLOW_THREADS
+    ret = inflate_block(compressed, compressed_length,
+                        (uint8_t *)PyBytes_AS_STRING(retval), isize, crc);
+    Py_END_ALLOW_THREADS
+    switch (ret) {
+        case BGZF_OK:
+            break;
+        case BGZF_ZLIB_INIT_ERROR:
+            PyErr_SetString(PyExc_RuntimeError,
+                            "Failed to initialize zlib inflate.");
+            Py_DECREF(retval);
+            goto error;
+        case BGZF_INFLATE_ERROR:
+            PyErr_SetString(BGZFError,
+                            "Corrupted deflate data in BGZF block.");
+            Py_DECREF(retval);
+            goto error;
+        case BGZF_CRC_ERROR:
+            PyErr_SetString(BGZFError,
+                            "Checksum fail of decompressed block.");
+            Py_DECREF(retval);
+            goto error;
+    }
+    PyBuffer_Release(&view);
+    return retval;
+error:
+    PyBuffer_Release(&view);
+    return NULL;
+}
+
+// Generic gzip header (10 bytes) plus the XLEN field and the BC extra
+// subfield with a placeholder for BSIZE. Same as bgzf.py's BGZF_BASE_HEADER
+// but with the two BSIZE bytes included so the compressed data starts at
+// offset 18.
+static const uint8_t bgzf_base_header[18] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff,
+    0x06, 0x00, 0x42, 0x43, 0x02, 0x00, 0x00, 0x00,
+};
+
+#define BGZF_BLOCK_OVERHEAD 26  // 18 byte header + 8 byte trailer.
+
+/**
+ * @brief Deflate one block of data and calculate its checksum.
+ *
+ * Runs without touching any Python objects so it can be called with the GIL
+ * released.
+ *
+ * @param data Pointer to the uncompressed data.
+ * @param length Length of the uncompressed data.
+ * @param level The compression level passed to zlib.
+ * @param dest Destination buffer for the raw deflate stream.
+ * @param dest_size Size of the destination buffer.
+ * @param crc Receives the CRC32 of the uncompressed data.
+ * @return Py_ssize_t The length of the deflate stream or -1 on error.
+ */
+static Py_ssize_t
+deflate_block(const uint8_t *data, Py_ssize_t length, int level,
+              uint8_t *dest, Py_ssize_t dest_size, uint32_t *crc)
+{
+    z_stream zst;
+    memset(&zst, 0, sizeof(z_stream));
+    // Negative wbits for a raw deflate stream without gzip/zlib headers.
+    if (deflateInit2(&zst, level, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+    zst.next_in = (uint8_t *)data;
+    zst.avail_in = (uInt)length;
+    zst.next_out = dest;
+    zst.avail_out = (uInt)dest_size;
+    int ret = deflate(&zst, Z_FINISH);
+    deflateEnd(&zst);
+    if (ret != Z_STREAM_END) {
+        return -1;
+    }
+    *crc = (uint32_t)crc32(0, data, (uInt)length);
+    return (Py_ssize_t)zst.total_out;
+}
+
+PyDoc_STRVAR(bgzf_compress_block__doc__,
+"compress_block($module, data, level=1, /)\n"
+"--\n"
+"\n"
+"Compress data into one complete BGZF block and return it as bytes.\n"
+"\n"
+"  data\n"
+"    The data to compress. May not be larger than BGZF_BLOCK_SIZE (65280)\n"
+"    bytes. May be any object that supports the buffer protocol.\n"
+"  level\n"
+"    The zlib compression level.\n"
+"\n"
+"The returned block includes the gzip header with the BSIZE field and the\n"
+"CRC32 and ISIZE trailer, so it can be written to a BGZF file as is. The\n"
+"GIL is released during compression so multiple blocks can be compressed\n"
+"in parallel from a worker-thread pool.\n"
+);
+
+#define BGZF_COMPRESS_BLOCK_METHODDEF    \
+    {"compress_block", (PyCFunction)(void(*)(void))bgzf_compress_block, \
+     METH_VARARGS, bgzf_compress_block__doc__}
+
+static PyObject *
+bgzf_compress_block(PyObject *module, PyObject *args)
+{
+    Py_buffer view;
+    int level = 1;
+    if (!PyArg_ParseTuple(args, "y*|i:compress_block", &view, &level)) {
+        return NULL;
+    }
+    const uint8_t *data = view.buf;
+    Py_ssize_t length = view.len;
+    if (length > BGZF_BLOCK_SIZE) {
+        PyErr_Format(PyExc_ValueError,
+                     "Cannot write data larger than %d to a BGZF block.",
+                     BGZF_BLOCK_SIZE);
+        goto error;
+    }
+    // Deflate may expand incompressible data by a few bytes per 32K block.
+    // Even then the result always fits in a maximum size BGZF block, so one
+    // fixed size allocation suffices and the result is shrunk afterwards.
+    PyObject *retval = PyBytes_FromStringAndSize(NULL, BGZF_MAX_BLOCK_SIZE);
+    if (retval == NULL) {
+        PyErr_NoMemory();
+        goto error;
+    }
+    uint8_t *block = (uint8_t *)PyBytes_AS_STRING(retval);
+    uint32_t crc = 0;
+    Py_ssize_t compressed_length;
+    Py_BEGIN_ALLOW_THREADS
+    compressed_length = deflate_block(
+        data, length, level, block + 18,
+        BGZF_MAX_BLOCK_SIZE - BGZF_BLOCK_OVERHEAD, &crc);
+    Py_END_ALLOW_THREADS
+    if (compressed_length == -1) {
+        PyErr_SetString(PyExc_RuntimeError, "zlib deflate failed.");
+        Py_DECREF(retval);
+        goto error;
+    }
+    Py_ssize_t block_length = compressed_length + BGZF_BLOCK_OVERHEAD;
+    memcpy(block, bgzf_base_header, sizeof(bgzf_base_header));
+    // BSIZE is the total block size minus one.
+    block[16] = (block_length - 1) & 0xff;
+    block[17] = ((block_length - 1) >> 8) & 0xff;
+    uint8_t *trailer = block + 18 + compressed_length;
+    trailer[0] = crc & 0xff;
+    trailer[1] = (crc >> 8) & 0xff;
+    trailer[2] = (crc >> 16) & 0xff;
+    trailer[3] = (crc >> 24) & 0xff;
+    trailer[4] = length & 0xff;
+    trailer[5] = (length >> 8) & 0xff;
+    trailer[6] = (length >> 16) & 0xff;
+    trailer[7] = (length >> 24) & 0xff;
+    if (_PyBytes_Resize(&retval, block_length) != 0) {
+        goto error;
+    }
+    PyBuffer_Release(&view);
+    return retval;
+error:
+    PyBuffer_Release(&view);
+    return NULL;
+}
+
+static PyMethodDef _bgzf_methods[] = {
+    BGZF_DECOMPRESS_BLOCK_METHODDEF,
+    BGZF_COMPRESS_BLOCK_METHODDEF,
+    {NULL}
+};
+
+static struct PyModuleDef _bgzf_module = {
+    PyModuleDef_HEAD_INIT,
+    "_bgzf",   /* name of module */
+    NULL, /* module documentation, may be NULL */
+    -1,
+    _bgzf_methods  /* module methods */
+};
+
+PyMODINIT_FUNC
+PyInit__bgzf(void)
+{
+    PyObject *m;
+
+    m = PyModule_Create(&_bgzf_module);
+    if (m == NULL)
+        return NULL;
+
+    BGZFError = PyErr_NewException("_bgzf.BGZFError", PyExc_IOError, NULL);
+    if (BGZFError == NULL)
+        return NULL;
+    Py_INCREF(BGZFError);
+    if (PyModule_AddObject(m, "BGZFError", BGZFError) < 0)
+        return NULL;
+
+    PyModule_AddIntMacro(m, BGZF_MAX_BLOCK_SIZE);
+    PyModule_AddIntMacro(m, BGZF_BLOCK_SIZE);
+    return m;
+}
@@ -18,10 +18,17 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 import enum
+import collections
+import heapq
 import io
+import itertools
+import os
 import struct
+import tempfile
 import typing
-from typing import Dict, Iterator, List, Tuple
+from concurrent.futures import Future, ThreadPoolExecutor
+from typing import Callable, Deque, Dict, Iterable, Iterator, List, \
+    Optional, Sequence, Tuple, Union
 
 # Cigar is part of the API even if not used here.
 from ._bam import (  # noqa: F401
@@ -39,8 +46,12 @@ from ._bam import (  # noqa: F401
     BamRecord,
     Cigar,
     bam_iterator,
+    parse_bam_references,
+    scan_bam_references,
+    sort_bam_records,
 )
-from .bgzf import BGZFReader, BGZFWriter, BGZF_BLOCK_SIZE
+from .bgzf import BGZFReader, BGZFWriter, BGZF_BLOCK_SIZE, MmapBGZFReader
+from .index import BamIndex, read_index
 
 
 class CigarOp(enum.IntEnum):
@@ -80,9 +91,11 @@ class BamHeader:
         self.rg: List[Dict[str, str]] = []
         self.pg: List[Dict[str, str]] = []
         self.co: List[str] = []
-        self.references: List[BamReference] = []
+        # May be a lazy _bam.BamReferenceTable, which materializes
+        # BamReference objects on subscript only.
+        self.references: Sequence[BamReference] = []
         if references is not None:
-            self.references = references[:]
+            self.references = references
         lines = header.splitlines(keepends=False)
         if lines[0].startswith("@HD\t"):
             _, self.hd = self.parse_tag_line(lines[0])
@@ -161,9 +174,30 @@ class BamHeader:
         return header_buffer.getvalue()
 
 
+def _complete_records_end(data) -> int:
+    """The offset of the first incomplete BAM record in data, or len(data)
+    when the data ends on a record boundary."""
+    pos = 0
+    size = len(data)
+    while pos + 4 <= size:
+        block_size, = struct.unpack_from("<I", data, pos)
+        record_end = pos + 4 + block_size
+        if record_end > size:
+            break
+        pos = record_end
+    return pos
+
+
 class BamReader:
-    def __init__(self, filename: str):
-        self._file = BGZFReader(filename)
+    def __init__(self, filename: str, mmap: bool = False):
+        # A memory-mapped reader hands the record iterator memoryviews
+        # straight into the mapping for uncompressed (compresslevel=0)
+        # blocks, which makes rescanning intermediate files very cheap.
+        self._file = MmapBGZFReader(filename) if mmap else BGZFReader(filename)
+        self._filename = filename
+        self._index: Optional[BamIndex] = None
+        self._records_read = 0
+        self._header_leftover = b""
         self.header: BamHeader
         self._read_header()
 
@@ -182,27 +216,166 @@ class BamReader:
         header_size, = struct.unpack("<I", self._file.read(4))
         sam_header = self._file.read(header_size)
         number_of_references, = struct.unpack("<I", self._file.read(4))
-        references = []
-        for i in range(number_of_references):
-            name_length, = struct.unpack("<I", self._file.read(4))
-            name = self._file.read(name_length)
-            seq_len, = struct.unpack("<I", self._file.read(4))
-            references.append(BamReference(name.decode('ascii'), seq_len))
+        # Scan the reference block in C, one BGZF block at a time. The
+        # scan is resumable so blocks never have to be rescanned.
+        buffer = bytearray(self._file.read_until_next_block())
+        position = 0
+        scanned = 0
+        while scanned < number_of_references:
+            entries, position = scan_bam_references(
+                buffer, position, number_of_references - scanned)
+            scanned += entries
+            if scanned < number_of_references:
+                block = self._file.read_until_next_block()
+                if not block:
+                    raise BAMFormatError("Truncated BAM reference table")
+                buffer += block
+        references = parse_bam_references(
+            bytes(buffer[:position]), number_of_references, BamReference)
+        # Bytes read past the reference block belong to the first records
+        # and are handed to the record iterator.
+        self._header_leftover = bytes(buffer[position:])
         self.header = BamHeader(sam_header.decode('ascii'), references)
 
+    def _record_buffers(self) -> Iterator[bytes]:
+        """Yield buffers that hold only complete records, in file order.
+        Records larger than one BGZF block (long reads) are spread over
+        multiple blocks by BamWriter, so the incomplete record at the end
+        of a block is carried over into the next buffer."""
+        leftover = b""
+        header_leftover = self._header_leftover
+        self._header_leftover = b""
+        blocks = itertools.chain((header_leftover,
+                                  self._file.read_until_next_block()),
+                                 iter(self._file))
+        for block in blocks:
+            data = leftover + bytes(block) if leftover else block
+            end = _complete_records_end(data)
+            if end == len(data):
+                leftover = b""
+                if len(data):
+                    yield data
+            else:
+                leftover = bytes(data[end:])
+                if end:
+                    yield data[:end]
+        if leftover:
+            raise BAMFormatError("Truncated BAM record at end of file")
+
     def __iter__(self) -> Iterator[BamRecord]:
-        yield from bam_iterator(self._file.read_until_next_block())
-        for block in iter(self._file):
-            yield from bam_iterator(block)
+        for data in self._record_buffers():
+            iterator = bam_iterator(data)
+            try:
+                yield from iterator
+            finally:
+                self._records_read += iterator.records_yielded
+
+    def map_blocks(self, func: Callable, threads: int = 1) -> Iterator:
+        """Apply func to every buffer of complete records, in file order.
+
+        Each buffer holds whole records only, so func can run bam_iterator
+        over it independently of the other buffers. With threads > 1 the
+        calls are dispatched to a thread pool while the reader keeps
+        decompressing, and the results are still yielded in file order.
+        This parallelizes per-record statistics jobs without any offset
+        arithmetic in the caller."""
+        if threads < 1:
+            raise ValueError(
+                f"threads must be at least 1, got {threads}")
+        buffers = self._record_buffers()
+        if threads == 1:
+            for data in buffers:
+                yield func(data)
+            return
+        with ThreadPoolExecutor(max_workers=threads) as pool:
+            futures: Deque["Future"] = collections.deque()
+            # Limit the read ahead so only a few buffers per worker thread
+            # are held in memory at any time.
+            max_queued_buffers = threads * 4
+            buffers_exhausted = False
+            while True:
+                while (not buffers_exhausted
+                        and len(futures) < max_queued_buffers):
+                    try:
+                        data = next(buffers)
+                    except StopIteration:
+                        buffers_exhausted = True
+                        break
+                    futures.append(pool.submit(func, data))
+                if not futures:
+                    return
+                yield futures.popleft().result()
+
+    @property
+    def stats(self) -> Dict[str, Union[int, float]]:
+        """Instrumentation counters: the number of records read plus the
+        block, byte and timing counters of the underlying BGZF reader."""
+        return {"records_read": self._records_read, **self._file.stats}
+
+    def _get_index(self) -> BamIndex:
+        if self._index is None:
+            for extension in (".bai", ".csi"):
+                index_filename = self._filename + extension
+                if os.path.exists(index_filename):
+                    self._index = read_index(index_filename)
+                    break
+            else:
+                raise FileNotFoundError(
+                    f"No index found for {self._filename}. Looked for "
+                    f"{self._filename}.bai and {self._filename}.csi.")
+        return self._index
+
+    def fetch(self, reference: str, start: int = 0,
+              end: Optional[int] = None) -> Iterator[BamRecord]:
+        """Fetch all records overlapping [start, end) on the reference.
+
+        Requires a BAI or CSI index next to the BAM file and a
+        coordinate-sorted BAM file. The index is used to seek straight to
+        the first BGZF block that can contain overlapping records."""
+        for reference_id, bam_reference in enumerate(self.header.references):
+            if bam_reference.name == reference:
+                break
+        else:
+            raise ValueError(f"Unknown reference: {reference}")
+        if end is None:
+            end = bam_reference.length
+        virtual_offset = self._get_index().first_offset(
+            reference_id, start, end)
+        if virtual_offset is None:
+            # The index shows no records can overlap the region.
+            return
+        # Any record bytes left over from header parsing belong to the
+        # start of the file, not to the seek target.
+        self._header_leftover = b""
+        self._file.seek(virtual_offset)
+        for record in self:
+            if record._refID != reference_id:
+                if record._refID == -1 or record._refID > reference_id:
+                    # Sorted: unmapped or further references, no more hits.
+                    return
+                continue
+            if record._pos >= end:
+                return
+            if record.reference_end > start:
+                yield record
 
 
 class BamWriter:
-    def __init__(self, filename: str, header: BamHeader, compresslevel=None):
-        self._file = BGZFWriter(filename, compresslevel)
+    def __init__(self, filename: str, header: BamHeader, compresslevel=None,
+                 threads: int = 1):
+        self._file = BGZFWriter(filename, compresslevel, threads)
         self.header = header
+        self._records_written = 0
         self._write_header()
         self._buffer = _BamBlockBuffer(BGZF_BLOCK_SIZE)
 
+    @property
+    def stats(self) -> Dict[str, Union[int, float]]:
+        """Instrumentation counters: the number of records written plus the
+        block, byte and timing counters of the underlying BGZF writer."""
+        return {"records_written": self._records_written,
+                **self._file.stats}
+
     def close(self):
         self.flush()
         self._file.close()
@@ -222,6 +395,7 @@ class BamWriter:
         self._buffer.reset()
 
     def write(self, bam_record: BamRecord):
+        self._records_written += 1
         if not self._buffer.write(bam_record):
             # Returned 0, buffer is full.
             self._file.write_block(self._buffer.get_block_view())
@@ -231,3 +405,121 @@ class BamWriter:
                 # blocks.
                 self._file.write(bam_record.to_bytes())
                 self._file.flush()
+
+    def write_many(self, bam_records: Iterable[BamRecord]):
+        """Write many records with one C call per filled block instead of
+        one call per record."""
+        records = (bam_records if isinstance(bam_records, (list, tuple))
+                   else list(bam_records))
+        index = 0
+        number_of_records = len(records)
+        while index < number_of_records:
+            buffer_was_empty = self._buffer.bytes_written == 0
+            written = self._buffer.write_many(records, index)
+            index += written
+            self._records_written += written
+            if index == number_of_records:
+                return
+            if written == 0 and buffer_was_empty:
+                # BamRecord too big for a single block. Distribute over
+                # multiple blocks.
+                self._file.write(records[index].to_bytes())
+                self._file.flush()
+                index += 1
+                self._records_written += 1
+                continue
+            # Buffer is full: flush it and continue with the remainder.
+            self._file.write_block(self._buffer.get_block_view())
+            self._buffer.reset()
+
+
+def _coordinate_sort_key(record: BamRecord) -> int:
+    """The 64-bit coordinate sort key. refID and pos are taken as unsigned,
+    so unmapped records (refID -1) sort last. Must order records the same
+    way as sort_bam_records."""
+    return ((record._refID & 0xffffffff) << 32) | (record._pos & 0xffffffff)
+
+
+class BamSorter:
+    """Write coordinate-sorted BAM output.
+
+    Records are serialized into an in-memory arena. When the arena exceeds
+    max_memory it is sorted in C and spilled to a temporary BGZF file.
+    finalize() merges the sorted runs into the final output file. When the
+    header has an @HD line its sort order is set to coordinate."""
+
+    def __init__(self, filename: str, header: BamHeader,
+                 max_memory: int = 1 << 30, compresslevel=None,
+                 threads: int = 1):
+        if header.hd:
+            header.hd["SO"] = "coordinate"
+        self._writer = BamWriter(filename, header, compresslevel, threads)
+        self._max_memory = max_memory
+        self._arena = bytearray()
+        self._run_files: List[str] = []
+        self._finalized = False
+
+    def write(self, bam_record: BamRecord):
+        self._arena += bam_record.to_bytes()
+        if len(self._arena) >= self._max_memory:
+            self._spill()
+
+    def write_many(self, bam_records: Iterable[BamRecord]):
+        for bam_record in bam_records:
+            self.write(bam_record)
+
+    def _spill(self):
+        sorted_run = sort_bam_records(self._arena)
+        self._arena.clear()
+        handle, run_filename = tempfile.mkstemp(suffix=".bgzf")
+        os.close(handle)
+        # Level 1: the runs are only read back once, during the merge.
+        with BGZFWriter(run_filename, compresslevel=1) as run_file:
+            for offset in range(0, len(sorted_run), BGZF_BLOCK_SIZE):
+                run_file.write_block(
+                    sorted_run[offset:offset + BGZF_BLOCK_SIZE])
+        self._run_files.append(run_filename)
+
+    @staticmethod
+    def _iter_run(run_filename: str) -> Iterator[BamRecord]:
+        # The BGZF blocks of a run are cut at arbitrary byte offsets, so
+        # the incomplete record at the end of a block is carried over to
+        # the next block, just as in BamReader.__iter__.
+        with BGZFReader(run_filename) as run_file:
+            leftover = b""
+            for block in run_file:
+                data = leftover + block if leftover else block
+                end = _complete_records_end(data)
+                yield from bam_iterator(data[:end])
+                leftover = bytes(data[end:])
+            if leftover:
+                raise BAMFormatError("Truncated BAM record in sort run")
+
+    def finalize(self):
+        """Sort and merge all written records into the output file."""
+        if self._finalized:
+            return
+        self._finalized = True
+        runs = [self._iter_run(run_filename)
+                for run_filename in self._run_files]
+        if self._arena:
+            runs.append(iter(bam_iterator(sort_bam_records(self._arena))))
+        try:
+            for record in heapq.merge(*runs, key=_coordinate_sort_key):
+                self._writer.write(record)
+        finally:
+            self._writer.close()
+            self._arena = bytearray()
+            for run_filename in self._run_files:
+                os.remove(run_filename)
+            self._run_files = []
+
+    @property
+    def stats(self) -> Dict[str, Union[int, float]]:
+        return self._writer.stats
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.finalize()
@@ -18,100 +18,380 @@
 # OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 # SOFTWARE.
 
+import bisect
+import collections
 import io
+import mmap
+import queue
 import struct
-import zlib
-from typing import Iterator, Optional
+import threading
+import time
+from concurrent.futures import Future, ThreadPoolExecutor
+from typing import Deque, Dict, Iterator, List, Optional, Tuple, Union
 
-try:
-    from isal import isal_zlib
-except ImportError:
-    isal_zlib = None  # type: ignore
+from ._bgzf import BGZFError, compress_block, decompress_block
 
 GZIP_MAGIC = b"\x1f\x8b"
 GZIP_MAGIC_INT = int.from_bytes(GZIP_MAGIC, "little", signed=False)
 
 BGZF_MAX_BLOCK_SIZE = 0x10000  # 64K, 65536. Same as bgzf.h
 BGZF_BLOCK_SIZE = 0xff00  # 65280. Same as bgzf.h
+# Compressed BGZF members are coalesced up to this size and written with a
+# single write call, instead of one syscall per 64K member.
+BGZF_OUTPUT_COALESCE_SIZE = 0x100000  # 1 MiB
 
-# XFL not set
-BGZF_BASE_HEADER = b"\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00\x42\x43\x02\x00"  # noqa: E501
 
+def read_raw_bgzf_block(file: io.BufferedReader) -> bytes:
+    """Read one complete raw BGZF block including gzip header and trailer."""
+    block_pos = file.tell()
+    header = file.read(18)
+    if len(header) < 18:
+        raise EOFError(f"Truncated bgzf block at: {block_pos}")
+    magic, method, flags, mtime, xfl, os, xlen, si1, si2, slen, bsize = \
+        struct.unpack("<HBBIBBHBBHH", header)
+    if magic != GZIP_MAGIC_INT:
+        raise BGZFError(f"Invalid gzip block at: {block_pos}")
+    if method != 8:  # Deflate method
+        raise BGZFError(f"Unsupported compression method: {method} at"
+                        f"block starting at: {block_pos}")
+    if not flags & 4:
+        raise BGZFError(f"Gzip block should contain an extra field. "
+                        f"Block starts at: {block_pos}")
+    if xlen < 6:
+        raise BGZFError(f"XLEN too small at {block_pos}")
+    if not (si1 == 66 and si2 == 67 and slen == 2):
+        raise BGZFError(f"Invalid BSIZE fields at {block_pos}")
+    # BSIZE is the total block size minus one.
+    rest = file.read(bsize + 1 - 18)
+    if len(rest) < bsize + 1 - 18:
+        raise EOFError(f"Truncated block at: {block_pos}")
+    return header + rest
 
-class BGZFError(IOError):
-    pass
 
+def read_gzi(filename: str) -> List[Tuple[int, int]]:
+    """Read a .gzi index: the (compressed offset, uncompressed offset)
+    pairs of every block boundary after the first block. The implicit
+    (0, 0) entry of the first block is prepended, so the returned list
+    can be binary searched directly."""
+    with open(filename, "rb") as file:
+        data = file.read()
+    if len(data) < 8:
+        raise BGZFError(f"Truncated gzi index: {filename}")
+    number_of_entries, = struct.unpack_from("<Q", data)
+    if len(data) != 8 + number_of_entries * 16:
+        raise BGZFError(f"Truncated gzi index: {filename}")
+    entries = [(0, 0)]
+    for i in range(number_of_entries):
+        entries.append(struct.unpack_from("<QQ", data, 8 + i * 16))
+    return entries
 
-def decompress_bgzf_blocks(file: io.BufferedReader) -> Iterator[bytes]:
-    if isal_zlib:
-        decompress = isal_zlib.decompress
-        crc32 = isal_zlib.crc32
-    else:
-        decompress = zlib.decompress  # type: ignore
-        crc32 = zlib.crc32  # type: ignore
+
+def write_gzi(filename: str, entries: List[Tuple[int, int]]):
+    """Write (compressed offset, uncompressed offset) pairs as a .gzi
+    index. The pairs must not include the implicit (0, 0) first block."""
+    with open(filename, "wb") as file:
+        file.write(struct.pack("<Q", len(entries)))
+        file.write(b"".join(struct.pack("<QQ", compressed, uncompressed)
+                            for compressed, uncompressed in entries))
+
+
+def new_reader_stats() -> Dict[str, Union[int, float]]:
+    """Instrumentation counters maintained by the block iterators."""
+    return {"blocks_read": 0, "compressed_bytes": 0, "decompressed_bytes": 0,
+            "decompress_seconds": 0.0}
+
+
+def new_writer_stats() -> Dict[str, Union[int, float]]:
+    """Instrumentation counters maintained by BGZFWriter.write_block."""
+    return {"blocks_written": 0, "data_bytes": 0, "compressed_bytes": 0,
+            "compress_seconds": 0.0}
+
+
+def _timed_decompress_block(block: bytes) -> Tuple[bytes, float]:
+    start = time.perf_counter()
+    decompressed_block = decompress_block(block)
+    return decompressed_block, time.perf_counter() - start
+
+
+def _timed_compress_block(data, compresslevel: int) -> Tuple[bytes, float]:
+    start = time.perf_counter()
+    compressed_block = compress_block(data, compresslevel)
+    return compressed_block, time.perf_counter() - start
+
+
+def decompress_bgzf_blocks(file: io.BufferedReader,
+                           stats=None) -> Iterator[bytes]:
+    if stats is None:
+        stats = new_reader_stats()
     while True:
-        block_pos = file.tell()
-        header = file.read(18)
-        if len(header) < 18:
-            raise EOFError(f"Truncated bgzf block at: {block_pos}")
+        block = read_raw_bgzf_block(file)
+        # decompress_block parses the gzip header, inflates and performs the
+        # CRC32 and ISIZE checks in one C call with the GIL released.
+        decompressed_block, seconds = _timed_decompress_block(block)
+        stats["blocks_read"] += 1
+        stats["compressed_bytes"] += len(block)
+        stats["decompressed_bytes"] += len(decompressed_block)
+        stats["decompress_seconds"] += seconds
+        if decompressed_block == b"":
+            # EOF Block found, check if we are at the EOF or if there is
+            # another block.
+            if not file.peek(1):
+                return
+        yield decompressed_block
+
+
+def decompress_bgzf_blocks_threaded(file: io.BufferedReader,
+                                    threads: int,
+                                    stats=None) -> Iterator[bytes]:
+    """Like decompress_bgzf_blocks but reads ahead and dispatches the blocks
+    to a worker-thread pool. Blocks are yielded in file order. The GIL is
+    released during decompression, so the workers run truly in parallel.
+    The decompress_seconds counter sums the time spent in all workers."""
+    if stats is None:
+        stats = new_reader_stats()
+    with ThreadPoolExecutor(max_workers=threads) as pool:
+        futures: Deque["Future[Tuple[bytes, float]]"] = collections.deque()
+        # Limit the read ahead so only a few blocks per worker thread are
+        # held in memory at any time.
+        max_queued_blocks = threads * 4
+        file_at_eof = False
+        while True:
+            while not file_at_eof and len(futures) < max_queued_blocks:
+                block = read_raw_bgzf_block(file)
+                stats["compressed_bytes"] += len(block)
+                futures.append(pool.submit(_timed_decompress_block, block))
+                if not file.peek(1):
+                    file_at_eof = True
+            if not futures:
+                return
+            decompressed_block, seconds = futures.popleft().result()
+            stats["blocks_read"] += 1
+            stats["decompressed_bytes"] += len(decompressed_block)
+            stats["decompress_seconds"] += seconds
+            if decompressed_block == b"" and file_at_eof and not futures:
+                # EOF Block found at the end of the file.
+                return
+            yield decompressed_block
+
+
+def prefetch_bgzf_blocks(file: io.BufferedReader,
+                         readahead: int,
+                         threads: int = 1,
+                         stats=None) -> Iterator[bytes]:
+    """Decompress BGZF blocks while a background thread reads ahead.
+
+    The reader thread keeps up to readahead bytes of raw blocks queued, so
+    storage latency (network file systems in particular) overlaps with
+    decompression and record processing instead of being paid inline. With
+    threads > 1 the queued blocks are dispatched to a worker pool like
+    decompress_bgzf_blocks_threaded."""
+    if stats is None:
+        stats = new_reader_stats()
+    # Every queue slot holds one raw block of at most BGZF_MAX_BLOCK_SIZE,
+    # so the slot count bounds the readahead memory. Two slots at minimum:
+    # one being read, one ready for the consumer.
+    max_queued_blocks = max(2, readahead // BGZF_MAX_BLOCK_SIZE)
+    raw_blocks: "queue.Queue" = queue.Queue(maxsize=max_queued_blocks)
+    stop = threading.Event()
+
+    def read_loop():
+        try:
+            while not stop.is_set():
+                block = read_raw_bgzf_block(file)
+                at_eof = not file.peek(1)
+                raw_blocks.put((block, at_eof))
+                if at_eof:
+                    return
+        except BaseException as e:  # noqa: B036 -- reraised in consumer
+            raw_blocks.put(e)
+
+    reader_thread = threading.Thread(target=read_loop, daemon=True)
+    reader_thread.start()
+
+    def raw_block_iter() -> Iterator[Tuple[bytes, bool]]:
+        while True:
+            item = raw_blocks.get()
+            if isinstance(item, BaseException):
+                raise item
+            yield item
+            if item[1]:  # at_eof
+                return
+
+    try:
+        if threads > 1:
+            with ThreadPoolExecutor(max_workers=threads) as pool:
+                futures: Deque["Future[Tuple[bytes, float]]"] = \
+                    collections.deque()
+                source = raw_block_iter()
+                source_exhausted = False
+                max_inflight_blocks = threads * 4
+                while True:
+                    while (not source_exhausted
+                           and len(futures) < max_inflight_blocks):
+                        try:
+                            block, at_eof = next(source)
+                        except StopIteration:
+                            source_exhausted = True
+                            break
+                        stats["compressed_bytes"] += len(block)
+                        futures.append(
+                            pool.submit(_timed_decompress_block, block))
+                        source_exhausted = at_eof
+                    if not futures:
+                        return
+                    decompressed_block, seconds = futures.popleft().result()
+                    stats["blocks_read"] += 1
+                    stats["decompressed_bytes"] += len(decompressed_block)
+                    stats["decompress_seconds"] += seconds
+                    if (decompressed_block == b"" and source_exhausted
+                            and not futures):
+                        # EOF Block found at the end of the file.
+                        return
+                    yield decompressed_block
+        else:
+            for block, at_eof in raw_block_iter():
+                stats["compressed_bytes"] += len(block)
+                decompressed_block, seconds = _timed_decompress_block(block)
+                stats["blocks_read"] += 1
+                stats["decompressed_bytes"] += len(decompressed_block)
+                stats["decompress_seconds"] += seconds
+                if decompressed_block == b"" and at_eof:
+                    # EOF Block found at the end of the file.
+                    return
+                yield decompressed_block
+    finally:
+        stop.set()
+        # The reader thread may be blocked on a full queue; taking one item
+        # unblocks it so it can see the stop event and exit.
+        try:
+            raw_blocks.get_nowait()
+        except queue.Empty:
+            pass
+        reader_thread.join()
+
+
+def mmap_bgzf_blocks(mapping, offset: int = 0,
+                     stats=None) -> Iterator[memoryview]:
+    """Iterate over the decompressed blocks of a memory-mapped BGZF file.
+
+    Blocks that are stored uncompressed (written with compresslevel=0) are
+    yielded as zero-copy memoryviews straight into the mapping; their CRC32
+    is not verified. Compressed blocks are decompressed as usual."""
+    if stats is None:
+        stats = new_reader_stats()
+    view = memoryview(mapping)
+    length = len(view)
+    pos = offset
+    while pos < length:
+        if length - pos < 18:
+            raise EOFError(f"Truncated bgzf block at: {pos}")
         magic, method, flags, mtime, xfl, os, xlen, si1, si2, slen, bsize = \
-            struct.unpack("<HBBIBBHBBHH", header)
+            struct.unpack_from("<HBBIBBHBBHH", view, pos)
         if magic != GZIP_MAGIC_INT:
-            raise BGZFError(f"Invalid gzip block at: {block_pos}")
+            raise BGZFError(f"Invalid gzip block at: {pos}")
         if method != 8:  # Deflate method
             raise BGZFError(f"Unsupported compression method: {method} at"
-                            f"block starting at: {block_pos}")
+                            f"block starting at: {pos}")
         if not flags & 4:
             raise BGZFError(f"Gzip block should contain an extra field. "
-                            f"Block starts at: {block_pos}")
+                            f"Block starts at: {pos}")
         if xlen < 6:
-            raise BGZFError(f"XLEN too small at {block_pos}")
+            raise BGZFError(f"XLEN too small at {pos}")
         if not (si1 == 66 and si2 == 67 and slen == 2):
-            raise BGZFError(f"Invalid BSIZE fields at {block_pos}")
-        # Skip other xtra fields.
-        file.read(xlen - 6)
-        block_size = bsize - xlen - 19
-        block_peek = file.peek(1)
-        if block_peek[0] == 1:  # No compression.
-            length, inverse_length = struct.unpack("<HH", file.read(5)[1:])
-            if length != ~inverse_length & 0xFFFF or length != block_size - 5:
-                raise BGZFError(f"Corrupted uncompressed block at {block_pos}")
-            decompressed_block = file.read(length)
+            raise BGZFError(f"Invalid BSIZE fields at {pos}")
+        block_length = bsize + 1
+        if pos + block_length > length:
+            raise EOFError(f"Truncated block at: {pos}")
+        isize, = struct.unpack_from("<I", view, pos + block_length - 4)
+        deflate_start = pos + 12 + xlen
+        stored_length = 0
+        if view[deflate_start] == 1:
+            # A single stored (uncompressed) deflate block with the final
+            # bit set: the data can be handed out without any copying.
+            stored_length, = struct.unpack_from("<H", view, deflate_start + 1)
+        if stored_length == isize and view[deflate_start] == 1:
+            data_start = deflate_start + 5
+            decompressed_block: memoryview = \
+                view[data_start:data_start + stored_length]
         else:
-            block = file.read(block_size)
-            if len(block) < block_size:
-                raise EOFError(f"Truncated block at: {block_pos}")
-            # Decompress block, use the 64K as initial buffer size to avoid
-            # resizing of the buffer. (Max block size before compressing is
-            # slightly less than 64K for BGZF blocks). 64K is allocated faster
-            # than sizes that are not powers of 2.
-            decompressed_block = decompress(block,
-                                            wbits=-zlib.MAX_WBITS,
-                                            bufsize=65536)
-        trailer = file.read(8)
-        if len(trailer) < 8:
-            raise EOFError(f"Truncated block at: {block_pos}")
-        crc, isize = struct.unpack("<II", trailer)
-        if crc != crc32(decompressed_block):
-            raise BGZFError("Checksum fail of decompressed block")
-        if isize != len(decompressed_block):
-            raise BGZFError("Incorrect length of decompressed blocks.")
-        if decompressed_block == b"":
-            # EOF Block found, check if we are at the EOF or if there is
-            # another block.
-            if not file.peek(1):
-                return
+            decompressed_bytes, seconds = _timed_decompress_block(
+                view[pos:pos + block_length])
+            decompressed_block = memoryview(decompressed_bytes)
+            stats["decompress_seconds"] += seconds
+        stats["blocks_read"] += 1
+        stats["compressed_bytes"] += block_length
+        stats["decompressed_bytes"] += len(decompressed_block)
+        pos += block_length
+        if len(decompressed_block) == 0 and pos == length:
+            # EOF block at the end of the file.
+            return
         yield decompressed_block
 
 
 class BGZFReader:
-    def __init__(self, filename: str):
+    def __init__(self, filename: str, threads: int = 1, readahead: int = 0):
+        if threads < 1:
+            raise ValueError(
+                f"threads must be at least 1, got {threads}")
+        if readahead < 0:
+            raise ValueError(
+                f"readahead must not be negative, got {readahead}")
         self._file = open(filename, 'rb')
-        self._block_iter = decompress_bgzf_blocks(self._file)  # type: ignore
+        self._filename = filename
+        self._threads = threads
+        self._readahead = readahead
+        self._gzi: Optional[List[Tuple[int, int]]] = None
+        self.stats = new_reader_stats()
+        self._block_iter = self._new_block_iter()
+        self._buffer = io.BytesIO()
+        self._buffer_size = 0
+
+    def _new_block_iter(self) -> Iterator[bytes]:
+        if self._readahead > 0:
+            return prefetch_bgzf_blocks(self._file, self._readahead,
+                                        self._threads, self.stats)
+        if self._threads == 1:
+            return decompress_bgzf_blocks(self._file, self.stats)
+        return decompress_bgzf_blocks_threaded(self._file, self._threads,
+                                               self.stats)
+
+    def seek(self, virtual_offset: int):
+        """Seek to a BGZF virtual offset: the file offset of the start of a
+        BGZF block shifted 16 bits to the left, plus the offset of the
+        desired position inside the decompressed block. This is the same
+        coffset << 16 | uoffset encoding that BAM indexes use."""
+        coffset = virtual_offset >> 16
+        uoffset = virtual_offset & 0xFFFF
+        self._block_iter.close()
+        self._file.seek(coffset)
+        self._block_iter = self._new_block_iter()
         self._buffer = io.BytesIO()
         self._buffer_size = 0
+        if uoffset:
+            block = next(self._block_iter)
+            if uoffset > len(block):
+                raise BGZFError(
+                    f"Invalid virtual offset: {virtual_offset}. Offset "
+                    f"{uoffset} is beyond the end of the block at {coffset}.")
+            self._buffer = io.BytesIO(block)
+            self._buffer_size = len(block)
+            self._buffer.seek(uoffset)
+
+    def seek_uncompressed(self, offset: int):
+        """Seek to an offset in the uncompressed data stream, using the
+        .gzi index written next to the file (BGZFWriter's index=True).
+        Binary searches the block boundary pairs for the block holding
+        the offset and skips to the position inside it, so resuming a
+        long scan does not re-read anything."""
+        if self._gzi is None:
+            self._gzi = read_gzi(self._filename + ".gzi")
+            self._gzi_uncompressed = [entry[1] for entry in self._gzi]
+        block = bisect.bisect_right(self._gzi_uncompressed, offset) - 1
+        coffset, uoffset = self._gzi[block]
+        self.seek(coffset << 16 | (offset - uoffset))
 
     def close(self):
+        self._block_iter.close()
         self._buffer.close()
         self._file.close()
 
@@ -169,40 +449,152 @@ class BGZFReader:
         return self._buffer.read()
 
 
-def _zlib_compress(data, level: int = -1, wbits: int = zlib.MAX_WBITS) -> bytes:
-    """zlib.compress but with a wbits parameter."""
-    compressobj = zlib.compressobj(level, wbits=wbits)
-    return compressobj.compress(data) + compressobj.flush()
+class MmapBGZFReader(BGZFReader):
+    """BGZFReader backed by a memory mapping of the file.
+
+    The BGZF headers are parsed in place and blocks that are stored
+    uncompressed (compresslevel=0) are yielded as memoryviews straight
+    into the mapping, so iterating over such a file does not copy the
+    record data at all."""
+
+    def __init__(self, filename: str):
+        self._file = open(filename, 'rb')
+        self._mmap = mmap.mmap(self._file.fileno(), 0,
+                               access=mmap.ACCESS_READ)
+        self._filename = filename
+        self._threads = 1
+        self._readahead = 0
+        self._gzi = None
+        self.stats = new_reader_stats()
+        self._block_iter = self._new_block_iter()
+        self._buffer = io.BytesIO()
+        self._buffer_size = 0
+
+    def _new_block_iter(self) -> Iterator[bytes]:
+        # The file object is only used to keep track of the position, so
+        # seek() can be inherited unchanged.
+        return mmap_bgzf_blocks(self._mmap, self._file.tell(), self.stats)
+
+    def close(self):
+        self._block_iter.close()
+        self._buffer.close()
+        try:
+            self._mmap.close()
+        except BufferError:
+            # Zero-copy views into the mapping are still alive. The file
+            # is unmapped once the last view is garbage collected.
+            pass
+        self._file.close()
 
 
 class BGZFWriter:
-    def __init__(self, filename: str, compresslevel: Optional[int] = None):
+    def __init__(self, filename: str, compresslevel: Optional[int] = None,
+                 threads: int = 1, index: bool = False):
+        if threads < 1:
+            raise ValueError(
+                f"threads must be at least 1, got {threads}")
         self._file = open(filename, 'wb')
+        self._filename = filename
+        # With index=True the (compressed, uncompressed) offset of every
+        # block boundary is recorded and written to filename + ".gzi" on
+        # close, for BGZFReader.seek_uncompressed.
+        self._index_entries: Optional[List[Tuple[int, int]]] = \
+            [] if index else None
+        self._compressed_offset = 0
+        self._uncompressed_offset = 0
         self._buffer = io.BytesIO(bytearray(BGZF_MAX_BLOCK_SIZE))
         self._buffer_size = 0
         self._buffer.seek(0)
-        if isal_zlib:
-            compress = isal_zlib.compress
-            crc32 = isal_zlib.crc32
-        else:
-            compress = _zlib_compress
-            crc32 = zlib.crc32  # type: ignore
         default_compresslevel = 1
-        self._compress = compress
-        self._crc32 = crc32
         self.compresslevel = (compresslevel if compresslevel is not None
                               else default_compresslevel)
+        self.stats = new_writer_stats()
+        self._output_buffer: List[bytes] = []
+        self._output_buffer_size = 0
+        self._threads = threads
+        if threads > 1:
+            self._pool = ThreadPoolExecutor(max_workers=threads)
+            # The queue holds the futures in submission order, so the writer
+            # thread emits the compressed blocks in the order the raw blocks
+            # were handed to write_block. The size limit bounds the amount of
+            # blocks in flight.
+            self._queue: "queue.Queue[Optional[Tuple[Future[Tuple[bytes, float]], int]]]" \
+                = queue.Queue(maxsize=threads * 4)
+            self._writer_exception: Optional[BaseException] = None
+            self._writer_thread = threading.Thread(target=self._write_loop)
+            self._writer_thread.start()
+
+    def _queue_output(self, compressed_block: bytes):
+        """Queue a complete compressed BGZF member for output. Members are
+        coalesced so many of them go out in one write call."""
+        self._output_buffer.append(compressed_block)
+        self._output_buffer_size += len(compressed_block)
+        if self._output_buffer_size >= BGZF_OUTPUT_COALESCE_SIZE:
+            self._flush_output()
+
+    def _flush_output(self):
+        if not self._output_buffer:
+            return
+        if len(self._output_buffer) == 1:
+            self._file.write(self._output_buffer[0])
+        else:
+            self._file.write(b"".join(self._output_buffer))
+        self._output_buffer.clear()
+        self._output_buffer_size = 0
+
+    def _record_block_offsets(self, compressed_length: int,
+                              data_length: int):
+        """Record the boundary after a finished block for the gzi index.
+        The (0, 0) entry of the first block is implicit and not stored."""
+        self._compressed_offset += compressed_length
+        self._uncompressed_offset += data_length
+        self._index_entries.append(
+            (self._compressed_offset, self._uncompressed_offset))
+
+    def _write_loop(self):
+        try:
+            while True:
+                item = self._queue.get()
+                if item is None:
+                    self._flush_output()
+                    return
+                future, data_length = item
+                compressed_block, seconds = future.result()
+                self.stats["blocks_written"] += 1
+                self.stats["compressed_bytes"] += len(compressed_block)
+                # Summed over all workers.
+                self.stats["compress_seconds"] += seconds
+                if self._index_entries is not None:
+                    self._record_block_offsets(len(compressed_block),
+                                               data_length)
+                self._queue_output(compressed_block)
+        except BaseException as e:  # noqa: B036 -- reraised in caller thread
+            self._writer_exception = e
+            # Keep draining the queue so submitting threads never block on a
+            # full queue. The exception is reraised in write_block or close.
+            while self._queue.get() is not None:
+                pass
 
     def close(self):
         self.flush()
+        if self._threads > 1:
+            self._queue.put(None)
+            self._writer_thread.join()
+            self._pool.shutdown()
+            if self._writer_exception is not None:
+                raise self._writer_exception
         self.write_eof_block()
+        self._flush_output()
         self._buffer.close()
         self._file.close()
+        if self._index_entries is not None:
+            write_gzi(self._filename + ".gzi", self._index_entries)
 
     def write_eof_block(self):
-        self._file.write(b"\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00"
-                         b"\x42\x43\x02\x00\x1b\x00\x03\x00\x00\x00\x00\x00"
-                         b"\x00\x00\x00\x00")
+        self._queue_output(
+            b"\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00"
+            b"\x42\x43\x02\x00\x1b\x00\x03\x00\x00\x00\x00\x00"
+            b"\x00\x00\x00\x00")
 
     def __enter__(self):
         return self
@@ -222,31 +614,27 @@ class BGZFWriter:
         if data_length > BGZF_BLOCK_SIZE:
             raise ValueError(f"Cannot write data larger than "
                              f"{BGZF_BLOCK_SIZE} to a BGZF block.")
-        self._file.write(BGZF_BASE_HEADER)
-        if self.compresslevel:
-            compressed_block = self._compress(data, self.compresslevel,
-                                              wbits=-zlib.MAX_WBITS)
-            # Length of the compressed block + generic gzip header (10 bytes) +
-            # XLEN field (2 bytes)
-            bgzf_block_size_bytes = struct.pack("<H", len(compressed_block) + 25)
-            self._file.write(bgzf_block_size_bytes)
-            self._file.write(compressed_block)
-        else:
-            size_and_deflate_header = struct.pack(
-                "<HBHH",
-                data_length + 30,  # +5 for deflate header, + 25 for rest of block.
-                # Deflate block header: first bit signifying last block;
-                # second and third bit 0 and 0 means uncompressed block.
-                1,
-                data_length,  # LEN
-                ~data_length & 0xFFFF,  # NLEN
-            )
-            self._file.write(size_and_deflate_header)
-            self._file.write(data)
-        trailer = struct.pack("<II",
-                              self._crc32(data),
-                              data_length)
-        self._file.write(trailer)
+        self.stats["data_bytes"] += data_length
+        if self._threads > 1:
+            if self._writer_exception is not None:
+                raise self._writer_exception
+            # Copy the data: the caller may reuse the underlying buffer
+            # while a worker thread is still compressing it.
+            self._queue.put((self._pool.submit(
+                _timed_compress_block, bytes(data), self.compresslevel),
+                data_length))
+            return
+        # compress_block deflates and checksums with the GIL released and
+        # lays out the complete BGZF member (header, payload, trailer) in
+        # one contiguous buffer, so no per-field writes are needed.
+        compressed_block, seconds = _timed_compress_block(
+            data, self.compresslevel)
+        self.stats["blocks_written"] += 1
+        self.stats["compressed_bytes"] += len(compressed_block)
+        self.stats["compress_seconds"] += seconds
+        if self._index_entries is not None:
+            self._record_block_offsets(len(compressed_block), data_length)
+        self._queue_output(compressed_block)
 
     def write(self, data):
         data_length = len(data)
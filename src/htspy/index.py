@@ -0,0 +1,182 @@
+# Copyright (c) 2022 Ruben Vorderman
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Parsers for the BAI and CSI index formats that accompany BAM files.
+
+Both formats store, per reference sequence, an R-tree of bins with chunks
+of BGZF virtual file offsets (coffset << 16 | uoffset, as used by
+BGZFReader.seek). BAI additionally stores a linear index with the smallest
+virtual offset per 16 kbp window.
+"""
+
+import gzip
+import struct
+import typing
+from typing import Dict, List, Optional, Tuple
+
+BAI_MAGIC = b"BAI\x01"
+CSI_MAGIC = b"CSI\x01"
+
+# BAI is a CSI index with fixed parameters.
+BAI_MIN_SHIFT = 14
+BAI_DEPTH = 5
+
+
+class BAMIndexFormatError(Exception):
+    pass
+
+
+def reg2bin(start: int, end: int, min_shift: int = BAI_MIN_SHIFT,
+            depth: int = BAI_DEPTH) -> int:
+    """Compute the smallest bin that fully contains [start, end)."""
+    end -= 1
+    level = depth
+    shift = min_shift
+    while level > 0:
+        if start >> shift == end >> shift:
+            return ((1 << (level * 3)) - 1) // 7 + (start >> shift)
+        shift += 3
+        level -= 1
+    return 0
+
+
+def reg2bins(start: int, end: int, min_shift: int = BAI_MIN_SHIFT,
+             depth: int = BAI_DEPTH) -> List[int]:
+    """List all bins that may overlap the region [start, end)."""
+    bins = []
+    end -= 1
+    first_bin = 0
+    shift = min_shift + depth * 3
+    for level in range(depth + 1):
+        bins.extend(range(first_bin + (start >> shift),
+                          first_bin + (end >> shift) + 1))
+        shift -= 3
+        first_bin += 1 << (level * 3)
+    return bins
+
+
+class ReferenceIndex(typing.NamedTuple):
+    # bin number -> list of (virtual offset begin, virtual offset end) chunks
+    bins: Dict[int, List[Tuple[int, int]]]
+    # Linear index: smallest virtual offset of the records overlapping each
+    # 2^min_shift window. Empty for CSI indexes.
+    intervals: List[int]
+
+
+class BamIndex:
+    def __init__(self, references: List[ReferenceIndex],
+                 min_shift: int = BAI_MIN_SHIFT, depth: int = BAI_DEPTH):
+        self.references = references
+        self.min_shift = min_shift
+        self.depth = depth
+
+    def first_offset(self, reference_id: int, start: int,
+                     end: int) -> Optional[int]:
+        """The virtual offset from which to scan for records overlapping
+        [start, end) on the given reference. None when the index shows no
+        records can overlap the region."""
+        if not (0 <= reference_id < len(self.references)):
+            return None
+        reference = self.references[reference_id]
+        minimum_offset = 0
+        if reference.intervals:
+            window = start >> self.min_shift
+            if window < len(reference.intervals):
+                minimum_offset = reference.intervals[window]
+            else:
+                minimum_offset = reference.intervals[-1]
+        chunk_starts = [
+            chunk_start
+            for bin_number in reg2bins(start, end, self.min_shift, self.depth)
+            for chunk_start, chunk_end in reference.bins.get(bin_number, ())
+            if chunk_end > minimum_offset
+        ]
+        if not chunk_starts:
+            return None
+        return max(min(chunk_starts), minimum_offset)
+
+
+def read_bai(file: typing.BinaryIO) -> BamIndex:
+    magic = file.read(4)
+    if magic != BAI_MAGIC:
+        raise BAMIndexFormatError(f"Not a BAI file, magic: {magic!r}")
+    # Bin numbers above the largest real bin are pseudo-bins with metadata.
+    max_bin = ((1 << ((BAI_DEPTH + 1) * 3)) - 1) // 7
+    number_of_references, = struct.unpack("<i", file.read(4))
+    references = []
+    for _ in range(number_of_references):
+        bins: Dict[int, List[Tuple[int, int]]] = {}
+        number_of_bins, = struct.unpack("<i", file.read(4))
+        for _ in range(number_of_bins):
+            bin_number, number_of_chunks = struct.unpack("<Ii", file.read(8))
+            chunks = [struct.unpack("<QQ", file.read(16))
+                      for _ in range(number_of_chunks)]
+            if bin_number <= max_bin:
+                bins[bin_number] = chunks
+        number_of_intervals, = struct.unpack("<i", file.read(4))
+        intervals = list(struct.unpack(
+            f"<{number_of_intervals}Q", file.read(8 * number_of_intervals)))
+        references.append(ReferenceIndex(bins, intervals))
+    return BamIndex(references, BAI_MIN_SHIFT, BAI_DEPTH)
+
+
+def read_csi(file: typing.BinaryIO) -> BamIndex:
+    magic = file.read(4)
+    if magic != CSI_MAGIC:
+        raise BAMIndexFormatError(f"Not a CSI file, magic: {magic!r}")
+    min_shift, depth, aux_length = struct.unpack("<iii", file.read(12))
+    file.read(aux_length)
+    max_bin = ((1 << ((depth + 1) * 3)) - 1) // 7
+    number_of_references, = struct.unpack("<i", file.read(4))
+    references = []
+    for _ in range(number_of_references):
+        bins: Dict[int, List[Tuple[int, int]]] = {}
+        number_of_bins, = struct.unpack("<i", file.read(4))
+        for _ in range(number_of_bins):
+            # The per-bin loffset is not used: chunk filtering alone is
+            # correct, a linear index would only prune the scan further.
+            bin_number, _loffset, number_of_chunks = struct.unpack(
+                "<IQi", file.read(16))
+            chunks = [struct.unpack("<QQ", file.read(16))
+                      for _ in range(number_of_chunks)]
+            if bin_number <= max_bin:
+                bins[bin_number] = chunks
+        references.append(ReferenceIndex(bins, []))
+    return BamIndex(references, min_shift, depth)
+
+
+def read_index(filename: str) -> BamIndex:
+    """Read a BAI or CSI index file, detected by its magic bytes. CSI
+    files are BGZF (gzip) compressed and are decompressed transparently."""
+    with open(filename, "rb") as raw_file:
+        magic = raw_file.read(2)
+    if magic == b"\x1f\x8b":
+        file: typing.BinaryIO = gzip.open(filename, "rb")  # type: ignore
+    else:
+        file = open(filename, "rb")
+    with file:
+        magic = file.read(4)
+        file.seek(0)
+        if magic == BAI_MAGIC:
+            return read_bai(file)
+        if magic == CSI_MAGIC:
+            return read_csi(file)
+        raise BAMIndexFormatError(
+            f"Not a BAI or CSI file: {filename}, magic: {magic!r}")
@@ -1,9 +1,12 @@
 import array
+import pickle
 import struct
 import sys
 
-from htspy._bam import BAM_CDIFF, BAM_CIGAR_SHIFT, BAM_CMATCH, \
-    BAM_FUNMAP, BamRecord, Cigar, bam_iterator
+from htspy._bam import BAM_CDIFF, BAM_CIGAR_SHIFT, BAM_CINS, BAM_CMATCH, \
+    BAM_FUNMAP, BamBlockBuffer, BamRecord, Cigar, bam_block_to_columns, \
+    bam_block_to_sam, bam_iterator, decode_sequences, merge_bam_records, \
+    parse_bam_references, scan_bam_references, sort_bam_records
 
 import pytest
 
@@ -423,3 +426,793 @@ def test_set_array_tag_buffer_released():
     bam = BamRecord()
     bam.set_tag("XX", my_array)
     assert sys.getrefcount(my_array) == my_array_refs
+
+
+def example_bam_record_bytes() -> bytes:
+    reference_id = 3
+    pos = 10000
+    read_name = b"my_forward_read/1"
+    cigar = array.array("I", (BAM_CMATCH | (4 << BAM_CIGAR_SHIFT),
+                              BAM_CDIFF | (3 << BAM_CIGAR_SHIFT)))
+    bam_struct = struct.pack("<iiBBHHHIiii",
+                             reference_id, pos, len(read_name) + 1, 99, 1001,
+                             len(cigar), 0, 7, -1, -1, 7)
+    bam_record_without_block_size = (
+        bam_struct + read_name + b"\x00" + cigar.tobytes() +
+        b'\x41\x88\x12\x10' + b'#######' + b"RGZMySample\x00")
+    return (struct.pack("<I", len(bam_record_without_block_size)) +
+            bam_record_without_block_size)
+
+
+def test_lazy_bam_record():
+    bam_record = example_bam_record_bytes()
+    eager = next(bam_iterator(bam_record))
+    lazy = next(bam_iterator(bam_record, lazy=True))
+    assert lazy._block_size == eager._block_size
+    assert lazy._refID == eager._refID
+    assert lazy._pos == eager._pos
+    assert lazy._l_read_name == eager._l_read_name
+    assert lazy._mapq == eager._mapq
+    assert lazy._bin == eager._bin
+    assert lazy._n_cigar_op == eager._n_cigar_op
+    assert lazy._flag == eager._flag
+    assert lazy._l_seq == eager._l_seq
+    assert lazy._next_refID == eager._next_refID
+    assert lazy._next_pos == eager._next_pos
+    assert lazy._tlen == eager._tlen
+    assert lazy._read_name == eager._read_name
+    assert lazy.read_name == eager.read_name
+    assert lazy._cigar == eager._cigar
+    assert lazy.cigar == eager.cigar
+    assert lazy._seq == eager._seq
+    assert lazy._qual == eager._qual
+    assert lazy.qualities == eager.qualities
+    assert lazy._tags == eager._tags
+    assert lazy.get_sequence() == eager.get_sequence()
+    assert lazy.get_tag("RG") == eager.get_tag("RG")
+    assert lazy.to_bytes() == bam_record
+    assert lazy.is_paired == eager.is_paired
+    assert lazy.is_unmapped == eager.is_unmapped
+
+
+def test_lazy_bam_record_is_readonly():
+    lazy = next(bam_iterator(example_bam_record_bytes(), lazy=True))
+    with pytest.raises(AttributeError):
+        lazy.flag = 4
+
+
+def test_lazy_bam_record_caches_decoded_fields():
+    lazy = next(bam_iterator(example_bam_record_bytes(), lazy=True))
+    assert lazy._read_name is lazy._read_name
+    assert lazy._tags is lazy._tags
+
+
+def test_lazy_bam_record_truncated():
+    bam_record = example_bam_record_bytes()
+    with pytest.raises(EOFError) as error:
+        list(bam_iterator(bam_record[:-1], lazy=True))
+    error.match("Truncated")
+
+
+def test_recycling_bam_iterator():
+    bam_record = example_bam_record_bytes()
+    records = bam_record * 3
+    seen = []
+    previous_id = None
+    for record in bam_iterator(records, recycle=True):
+        assert previous_id is None or id(record) == previous_id
+        previous_id = id(record)
+        seen.append(record.read_name)
+    assert seen == ["my_forward_read/1"] * 3
+
+
+def test_recycling_bam_iterator_changes_record_in_place():
+    bam_record = example_bam_record_bytes()
+    iterator = bam_iterator(bam_record * 2, recycle=True)
+    first = next(iterator)
+    second = next(iterator)
+    # The caller promises not to keep references: a kept reference observes
+    # the record changing in place.
+    assert first is second
+
+
+def test_bam_iterator_lazy_and_recycle_forbidden():
+    with pytest.raises(ValueError) as error:
+        bam_iterator(b"", lazy=True, recycle=True)
+    error.match("cannot be combined")
+
+
+def test_bam_iterator_not_a_buffer():
+    with pytest.raises(TypeError):
+        bam_iterator("not a buffer")
+
+
+@pytest.mark.parametrize("length", [0, 1, 7, 31, 32, 33, 63, 64, 150, 151])
+def test_decode_sequences(length):
+    sequence = ("ACGTNMRSVWYHKDB=" * 10)[:length]
+    record = BamRecord(read_name=b"my_read")
+    record.set_sequence(sequence)
+    data = record.to_bytes() * 3
+    assert decode_sequences(data) == [sequence] * 3
+    assert decode_sequences(data) == \
+        [parsed.get_sequence() for parsed in bam_iterator(data)]
+
+
+def test_decode_sequences_truncated():
+    record = BamRecord(read_name=b"my_read")
+    record.set_sequence("GATTACA")
+    with pytest.raises(EOFError) as error:
+        decode_sequences(record.to_bytes()[:-1])
+    error.match("Truncated")
+
+
+@pytest.mark.parametrize("length", [15, 16, 17, 31, 32, 33, 150, 151])
+def test_set_sequence_round_trip(empty_bam, length):
+    sequence = ("=ACMGRSVTWYHKDBN" * 10)[:length]
+    empty_bam.set_sequence(sequence)
+    assert empty_bam.get_sequence() == sequence
+
+
+@pytest.mark.parametrize("position", [0, 15, 16, 17, 40])
+def test_wrong_iupac_character_any_position(empty_bam, position):
+    sequence = "A" * position + "X" + "A" * (49 - position)
+    with pytest.raises(ValueError) as error:
+        empty_bam.set_sequence(sequence)
+    error.match("Not a IUPAC character: X")
+
+
+def test_lowercase_iupac_character(empty_bam):
+    with pytest.raises(ValueError) as error:
+        empty_bam.set_sequence("acgtacgtacgtacgtacgt")
+    error.match("Not a IUPAC character: a")
+
+
+def raw_bam_record(reference_id=-1, pos=-1, flag=BAM_FUNMAP, mapq=0,
+                   tlen=0, next_reference_id=-1, next_pos=-1,
+                   read_name=b"my_read") -> bytes:
+    bam_struct = struct.pack("<iiBBHHHIiii",
+                             reference_id, pos, len(read_name) + 1, mapq, 0,
+                             0, flag, 0, next_reference_id, next_pos, tlen)
+    bam_record_without_block_size = bam_struct + read_name + b"\x00"
+    block_size = len(bam_record_without_block_size)
+    return struct.pack("<I", block_size) + bam_record_without_block_size
+
+
+def test_bam_block_to_columns():
+    data = b"".join(
+        raw_bam_record(reference_id=i, pos=100 * i, flag=i % 4, mapq=30 + i,
+                       tlen=-i, next_reference_id=i + 1)
+        for i in range(5))
+    records = list(bam_iterator(data))
+    columns = bam_block_to_columns(data)
+    assert columns["refID"].tolist() == [r._refID for r in records]
+    assert columns["pos"].tolist() == [r._pos for r in records]
+    assert columns["flag"].tolist() == [r._flag for r in records]
+    assert columns["mapq"].tolist() == [r._mapq for r in records]
+    assert columns["tlen"].tolist() == [r._tlen for r in records]
+    assert columns["l_seq"].tolist() == [r._l_seq for r in records]
+    assert columns["next_refID"].tolist() == [r._next_refID for r in records]
+
+
+def test_bam_block_to_columns_formats():
+    columns = bam_block_to_columns(raw_bam_record())
+    assert columns["refID"].format == "i"
+    assert columns["flag"].format == "H"
+    assert columns["mapq"].format == "B"
+    assert columns["l_seq"].format == "I"
+
+
+def test_bam_block_to_columns_truncated():
+    with pytest.raises(EOFError) as error:
+        bam_block_to_columns(raw_bam_record()[:-1])
+    error.match("Truncated")
+
+
+def test_get_tag_repeated_lookups(empty_bam):
+    empty_bam._tags = b"".join(raw_tag for tag, raw_tag, result in TEST_TAGS)
+    # Look every tag up twice: the second lookup is served by the cached
+    # tag index.
+    for _ in range(2):
+        for tag, raw_tag, result in TEST_TAGS:
+            retrieved_tag = empty_bam.get_tag(tag)
+            if isinstance(retrieved_tag, memoryview):
+                retrieved_tag = retrieved_tag.tolist()
+            assert retrieved_tag == result
+
+
+def test_get_tag_index_invalidated_by_set_tag(empty_bam):
+    empty_bam._tags = b"ABAZ"
+    assert empty_bam.get_tag("AB") == "Z"
+    empty_bam.set_tag("NM", 5)
+    assert empty_bam.get_tag("NM") == 5
+    assert empty_bam.get_tag("AB") == "Z"
+
+
+def test_get_tag_index_invalidated_by_tags_setter(empty_bam):
+    empty_bam._tags = b"ABAZ"
+    assert empty_bam.get_tag("AB") == "Z"
+    empty_bam._tags = b"CDAY"
+    with pytest.raises(KeyError):
+        empty_bam.get_tag("AB")
+    assert empty_bam.get_tag("CD") == "Y"
+
+
+def test_get_tags_dict(empty_bam):
+    empty_bam._tags = b"ABAZ" + b"NMi" + struct.pack("<i", 5) + \
+        b"RXZACGT\x00"
+    assert empty_bam.get_tags_dict() == {"AB": "Z", "NM": 5, "RX": "ACGT"}
+
+
+def test_get_tags_dict_empty(empty_bam):
+    assert empty_bam.get_tags_dict() == {}
+
+
+def test_get_tags_dict_truncated(empty_bam):
+    empty_bam._tags = b"NMi\x05\x00"
+    with pytest.raises(ValueError) as error:
+        empty_bam.get_tags_dict()
+    error.match("truncated tag")
+
+
+def test_set_tags_matches_set_tag():
+    tags = {"RX": "ACGT", "NM": 3, "XF": 1.5,
+            "XA": array.array("b", [-20, 10, -126])}
+    one_by_one = BamRecord()
+    for tag, value in tags.items():
+        one_by_one.set_tag(tag, value)
+    batch = BamRecord()
+    batch.set_tags(tags)
+    assert batch._tags == one_by_one._tags
+
+
+def test_set_tags_replace_delete_insert(empty_bam):
+    empty_bam.set_tag("XX", 1)
+    empty_bam.set_tag("XY", 2)
+    empty_bam.set_tag("XZ", 3)
+    empty_bam.set_tags({"XX": 5, "XY": None, "RX": "ACGT"})
+    assert empty_bam.get_tags_dict() == {"XZ": 3, "XX": 5, "RX": "ACGT"}
+    # The block size must track the rebuilt tag buffer so the record still
+    # serializes correctly.
+    new_record = next(iter(bam_iterator(empty_bam.to_bytes())))
+    assert new_record.get_tags_dict() == empty_bam.get_tags_dict()
+
+
+def test_set_tags_empty_dict(empty_bam):
+    old_tags = empty_bam._tags
+    empty_bam.set_tags({})
+    assert empty_bam._tags is old_tags
+
+
+def test_set_tags_wrong_type(empty_bam):
+    with pytest.raises(TypeError) as error:
+        empty_bam.set_tags([("NM", 3)])
+    error.match("dict")
+
+
+def test_set_tags_wrong_tag_leaves_record_unchanged(empty_bam):
+    empty_bam.set_tag("XX", 1)
+    old_tags = empty_bam._tags
+    with pytest.raises(ValueError) as error:
+        empty_bam.set_tags({"XY": 2, "TOOLONG": 3})
+    error.match("length 2")
+    assert empty_bam._tags is old_tags
+
+
+def test_set_tags_buffer_released():
+    my_array = bytearray(1000)
+    my_array_refs = sys.getrefcount(my_array)
+    bam = BamRecord()
+    bam.set_tags({"XX": my_array})
+    assert sys.getrefcount(my_array) == my_array_refs
+
+
+def raw_mapped_record(reference_id, pos, flag=0, mapq=0, cigar=(),
+                      read_name=b"my_read") -> bytes:
+    cigar_array = array.array("I", cigar)
+    bam_struct = struct.pack("<iiBBHHHIiii",
+                             reference_id, pos, len(read_name) + 1, mapq, 0,
+                             len(cigar_array), flag, 0, -1, -1, 0)
+    bam_record_without_block_size = (bam_struct + read_name + b"\x00" +
+                                     cigar_array.tobytes())
+    block_size = len(bam_record_without_block_size)
+    return struct.pack("<I", block_size) + bam_record_without_block_size
+
+
+FILTER_TEST_DATA = (
+    raw_mapped_record(0, 100, flag=0, mapq=60, read_name=b"a",
+                      cigar=(BAM_CMATCH | (50 << BAM_CIGAR_SHIFT),)) +
+    raw_mapped_record(0, 200, flag=BAM_FUNMAP, mapq=0, read_name=b"b") +
+    raw_mapped_record(1, 100, flag=0, mapq=10, read_name=b"c",
+                      cigar=(BAM_CMATCH | (50 << BAM_CIGAR_SHIFT),))
+)
+
+
+@pytest.mark.parametrize(["kwargs", "expected_names"], [
+    (dict(), ["a", "b", "c"]),
+    (dict(flag_exclude=BAM_FUNMAP), ["a", "c"]),
+    (dict(flag_include=BAM_FUNMAP), ["b"]),
+    (dict(min_mapq=20), ["a"]),
+    # a spans [100, 150), b has no cigar and spans [200, 201).
+    (dict(region=(0, 120, 300)), ["a", "b"]),
+    (dict(region=(0, 150, 180)), []),
+    (dict(region=(0, 0, 150)), ["a"]),
+    (dict(region=(1, 0, 1000)), ["c"]),
+    (dict(region=(0, 0, 1000), lazy=True), ["a", "b"]),
+    (dict(region=(0, 0, 1000), recycle=True), ["a", "b"]),
+    (dict(flag_exclude=BAM_FUNMAP, min_mapq=20, region=(0, 0, 1000)), ["a"]),
+])
+def test_bam_iterator_filters(kwargs, expected_names):
+    names = [record.read_name
+             for record in bam_iterator(FILTER_TEST_DATA, **kwargs)]
+    assert names == expected_names
+
+
+def test_bam_iterator_invalid_region():
+    with pytest.raises(ValueError) as error:
+        bam_iterator(FILTER_TEST_DATA, region=(-1, 0, 100))
+    error.match("refID")
+
+
+def test_block_buffer_write_many():
+    records = [BamRecord(read_name=b"read%d" % i) for i in range(5)]
+    record_size = records[0]._block_size + 4
+    buffer = BamBlockBuffer(record_size * 3)
+    assert buffer.write_many(records) == 3
+    assert buffer.bytes_written == record_size * 3
+    buffer.reset()
+    # Continue where the first call left off.
+    assert buffer.write_many(records, 3) == 2
+    parsed = list(bam_iterator(buffer.get_block_view()))
+    assert [record.read_name for record in parsed] == ["read3", "read4"]
+
+
+def test_block_buffer_write_many_wrong_type():
+    buffer = BamBlockBuffer(1024)
+    with pytest.raises(TypeError) as error:
+        buffer.write_many([BamRecord(read_name=b"r"), "not a record"])
+    error.match("Type must be BamRecord")
+
+
+def test_set_cigar_updates_block_size(empty_bam):
+    old_block_size = empty_bam._block_size
+    empty_bam.cigar = Cigar("100M2I48M")
+    assert empty_bam._block_size == old_block_size + 3 * 4
+    empty_bam.cigar = Cigar("150M")
+    assert empty_bam._block_size == old_block_size + 4
+    # The serialized record must round trip with the correct length.
+    parsed = next(iter(bam_iterator(empty_bam.to_bytes())))
+    assert str(parsed.cigar) == "150M"
+
+
+def test_reference_end():
+    record = BamRecord(position=10_000)
+    # 5S and 2I do not consume the reference; 10M, 3D and 4N do.
+    record.cigar = Cigar("5S10M2I3D4N")
+    assert record.reference_end == 10_000 + 10 + 3 + 4
+
+
+def test_reference_end_no_cigar(empty_bam):
+    # Records without a reference-consuming cigar span one base.
+    assert empty_bam.reference_end == empty_bam._pos + 1
+
+
+def test_lazy_reference_end():
+    bam_record = example_bam_record_bytes()
+    eager = next(bam_iterator(bam_record))
+    lazy = next(bam_iterator(bam_record, lazy=True))
+    assert lazy.reference_end == eager.reference_end == 10_007
+
+
+def long_cigar() -> Cigar:
+    # 80_000 operations do not fit the 16-bit n_cigar_op field.
+    return Cigar.from_iter([(BAM_CMATCH, 2), (BAM_CINS, 1)] * 40_000)
+
+
+def test_long_cigar_spills_into_cg_tag(empty_bam):
+    empty_bam.set_sequence("GATTACA")
+    empty_bam.cigar = long_cigar()
+    # The cigar section holds the kSmN placeholder, the real cigar lives
+    # in the CG:B,I tag.
+    assert empty_bam._n_cigar_op == 2
+    assert str(empty_bam._cigar) == "7S80000N"
+    assert bytes(empty_bam._tags[:8]) == b"CGBI" + struct.pack("<I", 80_000)
+    assert empty_bam.cigar == long_cigar()
+    assert empty_bam.reference_end == empty_bam._pos + 80_000
+
+
+def test_long_cigar_round_trip(empty_bam):
+    empty_bam.set_sequence("GATTACA")
+    empty_bam.cigar = long_cigar()
+    serialized = empty_bam.to_bytes()
+    assert len(serialized) == empty_bam._block_size + 4
+    eager = next(bam_iterator(serialized))
+    assert eager.cigar == long_cigar()
+    lazy = next(bam_iterator(serialized, lazy=True))
+    assert lazy.cigar == long_cigar()
+    assert str(lazy._cigar) == "7S80000N"
+
+
+def test_short_cigar_drops_cg_tag(empty_bam):
+    empty_bam.set_sequence("GATTACA")
+    empty_bam.set_tag("NM", 5)
+    empty_bam.cigar = long_cigar()
+    empty_bam.cigar = Cigar("7M")
+    # The stale CG tag is removed when the cigar fits inline again.
+    assert empty_bam.get_tags_dict() == {"NM": 5}
+    assert empty_bam.cigar == Cigar("7M")
+    parsed = next(bam_iterator(empty_bam.to_bytes()))
+    assert parsed.cigar == Cigar("7M")
+
+
+def test_cg_stub_without_cg_tag_errors(empty_bam):
+    empty_bam.set_sequence("GATTACA")
+    empty_bam.cigar = long_cigar()
+    empty_bam.set_tag("CG", None)
+    with pytest.raises(ValueError) as error:
+        empty_bam.cigar
+    error.match("CG")
+
+
+def test_get_quality_string(empty_bam):
+    # Long enough to exercise the vectorized path plus a scalar tail.
+    qualities = bytes(list(range(94)) + [93] * 46)
+    empty_bam.set_sequence("GATTACA" * 20, qualities)
+    assert empty_bam.get_quality_string() == \
+        "".join(chr(quality + 33) for quality in qualities)
+
+
+def test_get_quality_string_missing(empty_bam):
+    # set_sequence without qualities fills qual with the 0xFF sentinel.
+    empty_bam.set_sequence("GATTACA")
+    with pytest.raises(ValueError) as error:
+        empty_bam.get_quality_string()
+    error.match("no qualities")
+
+
+def test_get_quality_string_out_of_range(empty_bam):
+    empty_bam.set_sequence("GATTACA", bytes([40, 40, 40, 94, 40, 40, 40]))
+    with pytest.raises(ValueError) as error:
+        empty_bam.get_quality_string()
+    error.match("94 at index 3")
+
+
+def test_set_quality_string(empty_bam):
+    empty_bam.set_sequence("GATTACA" * 20)
+    empty_bam.set_quality_string("I" * 140)
+    assert empty_bam.qualities == bytes([40]) * 140
+    assert empty_bam.get_quality_string() == "I" * 140
+
+
+def test_set_quality_string_wrong_length(empty_bam):
+    empty_bam.set_sequence("GATTACA")
+    with pytest.raises(ValueError) as error:
+        empty_bam.set_quality_string("II")
+    error.match("same length")
+
+
+def test_set_quality_string_invalid_character(empty_bam):
+    empty_bam.set_sequence("GATTACA")
+    # Space is below '!' and thus not a valid phred character.
+    with pytest.raises(ValueError) as error:
+        empty_bam.set_quality_string("III II" + "I")
+    error.match("phred")
+
+
+def test_set_quality_string_wrong_type(empty_bam):
+    with pytest.raises(TypeError) as error:
+        empty_bam.set_quality_string(b"III")
+    error.match("str")
+
+
+def test_lazy_get_quality_string():
+    bam_record = example_bam_record_bytes()
+    lazy = next(bam_iterator(bam_record, lazy=True))
+    # The raw phred scores are 35 ('#'), printed they become 68 ('D').
+    assert lazy.get_quality_string() == "DDDDDDD"
+
+
+def test_sort_bam_records():
+    records = [BamRecord(reference_id=reference_id, position=position,
+                         read_name=b"read%d" % i)
+               for i, (reference_id, position) in enumerate(
+                   [(1, 500), (0, 1000), (-1, -1), (0, 100), (1, 100)])]
+    data = b"".join(record.to_bytes() for record in records)
+    sorted_records = list(bam_iterator(sort_bam_records(data)))
+    coordinates = [(record._refID, record._pos)
+                   for record in sorted_records]
+    # Unmapped records (refID -1) sort last.
+    assert coordinates == [(0, 100), (0, 1000), (1, 100), (1, 500), (-1, -1)]
+
+
+def test_sort_bam_records_stable():
+    # Records with equal coordinates keep their input order.
+    records = [BamRecord(reference_id=0, position=100,
+                         read_name=b"read%d" % i) for i in range(10)]
+    data = b"".join(record.to_bytes() for record in records)
+    names = [record.read_name
+             for record in bam_iterator(sort_bam_records(data))]
+    assert names == ["read%d" % i for i in range(10)]
+
+
+def test_sort_bam_records_truncated():
+    record = BamRecord(read_name=b"read").to_bytes()
+    with pytest.raises(EOFError):
+        sort_bam_records(record[:-1])
+
+
+def test_sort_bam_records_empty():
+    assert sort_bam_records(b"") == b""
+
+
+def reference_block(references):
+    return b"".join(
+        struct.pack("<I", len(name)) + name + struct.pack("<I", length)
+        for name, length in references)
+
+
+def test_parse_bam_references():
+    block = reference_block([(b"chr1", 1000), (b"chr2", 2000)])
+    table = parse_bam_references(block, 2)
+    assert len(table) == 2
+    assert table[0] == ("chr1", 1000)
+    assert table[1] == ("chr2", 2000)
+    assert list(table) == [("chr1", 1000), ("chr2", 2000)]
+
+
+def test_parse_bam_references_factory():
+    block = reference_block([(b"chr1", 1000)])
+    table = parse_bam_references(block, 1, lambda name, length: (length, name))
+    # Items are only built when subscripted, through the factory.
+    assert table[0] == (1000, "chr1")
+
+
+def test_parse_bam_references_out_of_range():
+    table = parse_bam_references(reference_block([(b"chr1", 1000)]), 1)
+    with pytest.raises(IndexError):
+        table[1]
+
+
+def test_parse_bam_references_truncated():
+    block = reference_block([(b"chr1", 1000), (b"chr2", 2000)])
+    with pytest.raises(EOFError) as error:
+        parse_bam_references(block[:-1], 2)
+    error.match("Truncated")
+
+
+def test_scan_bam_references_resumes():
+    block = reference_block([(b"chr1", 1000), (b"chr2", 2000)])
+    # The first entry is 12 bytes; cut the second one short.
+    assert scan_bam_references(block[:20], 0, 2) == (1, 12)
+    # With the full block available the scan resumes where it stopped.
+    assert scan_bam_references(block, 12, 1) == (1, 24)
+
+
+def coordinate_stream(coordinates, prefix=b"n"):
+    """Serialize records for the given (refID, pos) coordinates into one
+    raw BAM buffer."""
+    return b"".join(
+        BamRecord(reference_id=reference_id, position=position,
+                  read_name=b"%s%d" % (prefix, i)).to_bytes()
+        for i, (reference_id, position) in enumerate(coordinates))
+
+
+def test_merge_bam_records():
+    streams = [[coordinate_stream([(0, 10), (0, 30), (1, 5)])],
+               [coordinate_stream([(0, 20), (0, 30), (-1, -1)])],
+               [coordinate_stream([(0, 15)])]]
+    merged = list(merge_bam_records(streams))
+    coordinates = [(record._refID, record._pos)
+                   for record in bam_iterator(b"".join(merged))]
+    # Unmapped records (refID -1) sort last.
+    assert coordinates == [(0, 10), (0, 15), (0, 20), (0, 30), (0, 30),
+                           (1, 5), (-1, -1)]
+
+
+def test_merge_bam_records_spanning_blocks():
+    # Split the streams at arbitrary points: records that span block
+    # boundaries are carried over and reassembled.
+    data_a = coordinate_stream([(0, 1), (0, 3), (0, 5)], b"a")
+    data_b = coordinate_stream([(0, 2), (0, 4), (0, 6)], b"b")
+    streams = [[data_a[i:i + 13] for i in range(0, len(data_a), 13)],
+               [data_b[i:i + 7] for i in range(0, len(data_b), 7)]]
+    merged = b"".join(merge_bam_records(streams))
+    names = [record.read_name for record in bam_iterator(merged)]
+    assert names == ["a0", "b0", "a1", "b1", "a2", "b2"]
+
+
+def test_merge_bam_records_stable():
+    # Records with equal (refID, pos, flag) come out in input order.
+    streams = [[coordinate_stream([(0, 100)], b"first")],
+               [coordinate_stream([(0, 100)], b"second")]]
+    merged = b"".join(merge_bam_records(streams))
+    names = [record.read_name for record in bam_iterator(merged)]
+    assert names == ["first0", "second0"]
+
+
+def test_merge_bam_records_single_input():
+    stream = coordinate_stream([(0, 1), (0, 2)])
+    assert b"".join(merge_bam_records([[stream]])) == stream
+
+
+def test_merge_bam_records_no_inputs():
+    assert list(merge_bam_records([])) == []
+
+
+def test_merge_bam_records_truncated():
+    stream = coordinate_stream([(0, 1), (0, 2)])
+    with pytest.raises(EOFError) as error:
+        list(merge_bam_records([[stream[:-1]]]))
+    error.match("Truncated")
+
+
+def test_bam_iterator_views():
+    bam_record = example_bam_record_bytes()
+    eager = next(bam_iterator(bam_record))
+    view_record = next(bam_iterator(bam_record, views=True))
+    # The variable-length fields are zero-copy slices into the block.
+    assert isinstance(view_record._read_name, memoryview)
+    assert isinstance(view_record._seq, memoryview)
+    assert isinstance(view_record._qual, memoryview)
+    assert isinstance(view_record._tags, memoryview)
+    assert view_record._read_name == eager._read_name
+    assert view_record._seq == eager._seq
+    assert view_record._qual == eager._qual
+    assert view_record._tags == eager._tags
+    assert view_record.read_name == eager.read_name
+    assert view_record.get_sequence() == eager.get_sequence()
+    assert view_record.to_bytes() == bam_record
+
+
+def test_bam_iterator_views_keep_block_alive():
+    data = bytearray(example_bam_record_bytes() * 3)
+    sequences = [record._seq for record in bam_iterator(bytes(data),
+                                                        views=True)]
+    del data
+    assert all(bytes(view) == b'\x41\x88\x12\x10' for view in sequences)
+
+
+def test_bam_iterator_views_do_not_leak_block():
+    data = example_bam_record_bytes() * 3
+    refcount_before = sys.getrefcount(data)
+    for record in bam_iterator(data, views=True):
+        record._read_name, record._seq, record._qual, record._tags
+    # The last record still holds the block; once it is gone the block
+    # refcount must be back at its starting value.
+    del record
+    assert sys.getrefcount(data) == refcount_before
+
+
+def test_bam_iterator_views_and_recycle():
+    with pytest.raises(ValueError) as error:
+        bam_iterator(example_bam_record_bytes(), views=True, recycle=True)
+    error.match("cannot be combined")
+
+
+EXAMPLE_REFERENCE_NAMES = ["chr1", "chr2", "chr3", "chr4"]
+# The '#' qualities (phred 35) become 'D' characters in SAM.
+EXAMPLE_SAM_LINE = ("my_forward_read/1\t0\tchr4\t10001\t99\t4M3X\t*\t0\t7\t"
+                    "GATTACA\tDDDDDDD\tRG:Z:MySample")
+
+
+def test_bam_record_to_sam_line():
+    record = next(bam_iterator(example_bam_record_bytes()))
+    assert record.to_sam_line(EXAMPLE_REFERENCE_NAMES) == EXAMPLE_SAM_LINE
+
+
+def test_lazy_bam_record_to_sam_line():
+    record = next(bam_iterator(example_bam_record_bytes(), lazy=True))
+    assert record.to_sam_line(EXAMPLE_REFERENCE_NAMES) == EXAMPLE_SAM_LINE
+
+
+def test_to_sam_line_unmapped():
+    record = next(bam_iterator(raw_bam_record()))
+    assert record.to_sam_line([]) == "my_read\t4\t*\t0\t0\t*\t*\t0\t0\t*\t*"
+
+
+def test_to_sam_line_mate_on_same_reference():
+    record = next(bam_iterator(raw_bam_record(
+        reference_id=1, pos=99, next_reference_id=1, next_pos=199, flag=0)))
+    assert record.to_sam_line(["chrM", "chr1"]).split("\t")[6] == "="
+
+
+def test_to_sam_line_refid_out_of_range():
+    record = next(bam_iterator(example_bam_record_bytes()))
+    with pytest.raises(ValueError) as error:
+        record.to_sam_line(["chr1"])
+    error.match("refID 3")
+
+
+def test_to_sam_line_wrong_reference_type():
+    record = next(bam_iterator(example_bam_record_bytes()))
+    with pytest.raises(TypeError) as error:
+        record.to_sam_line([b"chr1"] * 4)
+    error.match("str")
+
+
+TEST_SAM_TAGS = (
+    (b"ABAZ", "AB:A:Z"),
+    (b"CDZmystring\x00", "CD:Z:mystring"),
+    (b"EFHff00\x00", "EF:H:ff00"),
+    (b"GHc" + struct.pack("<b", -20), "GH:i:-20"),
+    (b"IJC" + struct.pack("<B", 170), "IJ:i:170"),
+    (b"KLs" + struct.pack("<h", -1024), "KL:i:-1024"),
+    (b"MNS" + struct.pack("<H", 65000), "MN:i:65000"),
+    (b"OPi" + struct.pack("<i", -2_147_483_648), "OP:i:-2147483648"),
+    (b"QRI" + struct.pack("<I", 4_294_967_295), "QR:i:4294967295"),
+    (b"STf" + struct.pack("<f", 2.4), "ST:f:2.4"),
+    (b"UVBc" + struct.pack("<Ibbb", 3, -20, 10, -126), "UV:B:c,-20,10,-126"),
+    (b"WXBI" + struct.pack("<III", 2, 80000, 4_000_000_000),
+     "WX:B:I,80000,4000000000"),
+    (b"YZBf" + struct.pack("<Ifff", 3, 1.1, 2.2, 3.3), "YZ:B:f,1.1,2.2,3.3"),
+)
+
+
+@pytest.mark.parametrize(["raw_tag", "sam_tag"], TEST_SAM_TAGS)
+def test_to_sam_line_tags(empty_bam, raw_tag, sam_tag):
+    empty_bam._tags = raw_tag
+    assert empty_bam.to_sam_line([]).split("\t")[11] == sam_tag
+
+
+def test_to_sam_line_long_cigar(empty_bam):
+    empty_bam.set_sequence("GATTACA")
+    empty_bam.cigar = long_cigar()
+    sam_line = empty_bam.to_sam_line([])
+    # The full cigar from the CG tag is emitted in the cigar column and
+    # the tag itself is not repeated in the tag columns.
+    assert sam_line.split("\t")[5] == str(long_cigar())
+    assert "CG" not in sam_line.split("\t")[11:]
+    assert sam_line.count("\t") == 10
+
+
+def test_bam_block_to_sam():
+    data = b"".join(raw_bam_record(read_name=b"read%d" % i)
+                    for i in range(5)) + example_bam_record_bytes()
+    expected = "".join(
+        record.to_sam_line(EXAMPLE_REFERENCE_NAMES) + "\n"
+        for record in bam_iterator(data))
+    assert bam_block_to_sam(data, EXAMPLE_REFERENCE_NAMES) == expected
+
+
+def test_bam_block_to_sam_empty():
+    assert bam_block_to_sam(b"", []) == ""
+
+
+def test_bam_block_to_sam_truncated():
+    with pytest.raises(EOFError) as error:
+        bam_block_to_sam(example_bam_record_bytes()[:-1],
+                         EXAMPLE_REFERENCE_NAMES)
+    error.match("Truncated")
+
+
+def test_bam_record_from_bytes():
+    raw = example_bam_record_bytes()
+    record = BamRecord.from_bytes(raw)
+    parsed = next(bam_iterator(raw))
+    assert record.to_bytes() == raw
+    assert record._read_name == parsed._read_name
+    assert record._cigar == parsed._cigar
+    assert record._seq == parsed._seq
+    assert record._qual == parsed._qual
+    assert record._tags == parsed._tags
+
+
+def test_bam_record_from_bytes_truncated():
+    with pytest.raises(EOFError) as error:
+        BamRecord.from_bytes(example_bam_record_bytes()[:-1])
+    error.match("Truncated")
+
+
+def test_bam_record_from_bytes_trailing_data():
+    with pytest.raises(ValueError) as error:
+        BamRecord.from_bytes(example_bam_record_bytes() + b"\x00")
+    error.match("trailing")
+
+
+def test_bam_record_pickle():
+    record = next(bam_iterator(example_bam_record_bytes()))
+    # The record crosses the pickle boundary as the single bytes object
+    # from to_bytes(), not as five separately pickled member objects.
+    clone = pickle.loads(pickle.dumps(record))
+    assert clone.to_bytes() == record.to_bytes()
+    assert clone.read_name == record.read_name
+    assert clone.get_tags_dict() == record.get_tags_dict()
@@ -0,0 +1,267 @@
+# Copyright (c) 2022 Ruben Vorderman
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import struct
+from pathlib import Path
+
+from htspy._bgzf import BGZFError, compress_block, decompress_block
+from htspy.bgzf import BGZF_BLOCK_SIZE, BGZFReader, BGZFWriter, \
+    MmapBGZFReader, read_gzi, read_raw_bgzf_block
+
+import pytest
+
+BGZF_EOF_BLOCK = (b"\x1f\x8b\x08\x04\x00\x00\x00\x00\x00\xff\x06\x00"
+                  b"\x42\x43\x02\x00\x1b\x00\x03\x00\x00\x00\x00\x00"
+                  b"\x00\x00\x00\x00")
+
+TEST_BLOCKS = [b"My hovercraft is full of eels", b"x" * 65280, b"a"]
+
+
+def test_decompress_eof_block():
+    assert decompress_block(BGZF_EOF_BLOCK) == b""
+
+
+def test_decompress_block_truncated():
+    with pytest.raises(BGZFError) as error:
+        decompress_block(BGZF_EOF_BLOCK[:20])
+    error.match("Truncated")
+
+
+def test_decompress_block_wrong_magic():
+    with pytest.raises(BGZFError) as error:
+        decompress_block(b"\x00\x00" + BGZF_EOF_BLOCK[2:])
+    error.match("magic")
+
+
+def test_decompress_block_wrong_checksum():
+    corrupted = BGZF_EOF_BLOCK[:-8] + b"\x01\x00\x00\x00" + BGZF_EOF_BLOCK[-4:]
+    with pytest.raises(BGZFError) as error:
+        decompress_block(corrupted)
+    error.match("Checksum")
+
+
+@pytest.mark.parametrize("data", TEST_BLOCKS)
+@pytest.mark.parametrize("level", [0, 1, 6])
+def test_compress_block_round_trip(data: bytes, level: int):
+    assert decompress_block(compress_block(data, level)) == data
+
+
+def test_compress_block_too_large():
+    with pytest.raises(ValueError) as error:
+        compress_block(b"x" * 65281)
+    error.match("larger than")
+
+
+@pytest.mark.parametrize("reader_threads", [1, 2, 4])
+@pytest.mark.parametrize("writer_threads", [1, 2, 4])
+@pytest.mark.parametrize("compresslevel", [0, 1])
+def test_bgzf_round_trip(tmp_path: Path, reader_threads: int,
+                         writer_threads: int, compresslevel: int):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file), compresslevel,
+                    threads=writer_threads) as writer:
+        for block in TEST_BLOCKS:
+            writer.write_block(block)
+    with BGZFReader(str(bgzf_file), threads=reader_threads) as reader:
+        # BGZFWriter.close() flushes its empty buffer as a zero-length block
+        # before writing the EOF block.
+        assert list(reader) == TEST_BLOCKS + [b""]
+
+
+def test_bgzf_reader_invalid_threads(tmp_path: Path):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file)):
+        pass
+    with pytest.raises(ValueError) as error:
+        BGZFReader(str(bgzf_file), threads=0)
+    error.match("threads")
+
+
+@pytest.mark.parametrize("compresslevel", [0, 1])
+def test_mmap_bgzf_reader(tmp_path: Path, compresslevel: int):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file), compresslevel) as writer:
+        for block in TEST_BLOCKS:
+            writer.write_block(block)
+    with MmapBGZFReader(str(bgzf_file)) as reader:
+        blocks = list(reader)
+        # Level 0 blocks are yielded as zero-copy views into the mapping.
+        if compresslevel == 0:
+            assert all(isinstance(block, memoryview) for block in blocks)
+        assert [bytes(block) for block in blocks] == TEST_BLOCKS + [b""]
+
+
+def test_mmap_bgzf_reader_seek(tmp_path: Path):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file), compresslevel=0) as writer:
+        for block in TEST_BLOCKS:
+            writer.write_block(block)
+    with open(bgzf_file, "rb") as raw:
+        read_raw_bgzf_block(raw)
+        second_block_offset = raw.tell()
+    with MmapBGZFReader(str(bgzf_file)) as reader:
+        reader.seek(second_block_offset << 16 | 10)
+        assert reader.read(20) == TEST_BLOCKS[1][10:30]
+
+
+def test_writer_and_reader_stats(tmp_path):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file)) as writer:
+        writer.write_block(b"first block")
+        writer.write_block(b"second block")
+        assert writer.stats["blocks_written"] == 2
+        assert writer.stats["data_bytes"] == 23
+        assert writer.stats["compressed_bytes"] > 0
+        assert writer.stats["compress_seconds"] > 0
+    with BGZFReader(str(bgzf_file)) as reader:
+        assert reader.readall() == b"first blocksecond block"
+        stats = reader.stats
+    assert stats["blocks_read"] >= 2
+    assert stats["decompressed_bytes"] == 23
+    assert stats["compressed_bytes"] > 0
+    assert stats["decompress_seconds"] > 0
+
+
+def test_threaded_writer_stats(tmp_path):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file), threads=2) as writer:
+        writer.write_block(b"first block")
+        writer.write_block(b"second block")
+    # The counters are updated by the writer thread, which has joined
+    # after close(). The final flush writes an empty block.
+    assert writer.stats["blocks_written"] == 3
+    assert writer.stats["data_bytes"] == 23
+    with BGZFReader(str(bgzf_file), threads=2) as reader:
+        assert reader.readall() == b"first blocksecond block"
+        assert reader.stats["decompressed_bytes"] == 23
+
+
+@pytest.mark.parametrize("reader_threads", [1, 2])
+@pytest.mark.parametrize("readahead", [1, 1024 * 1024])
+def test_bgzf_reader_readahead(tmp_path: Path, reader_threads: int,
+                               readahead: int):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file)) as writer:
+        for i in range(100):
+            writer.write_block(b"block%d" % i)
+    with BGZFReader(str(bgzf_file), threads=reader_threads,
+                    readahead=readahead) as reader:
+        assert list(reader) == [b"block%d" % i for i in range(100)] + [b""]
+
+
+def test_bgzf_reader_invalid_readahead(tmp_path: Path):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file)):
+        pass
+    with pytest.raises(ValueError) as error:
+        BGZFReader(str(bgzf_file), readahead=-1)
+    error.match("readahead")
+
+
+def test_bgzf_reader_readahead_seek(tmp_path: Path):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file)) as writer:
+        for block in TEST_BLOCKS:
+            writer.write_block(block)
+    with open(bgzf_file, "rb") as raw:
+        read_raw_bgzf_block(raw)
+        second_block_offset = raw.tell()
+    with BGZFReader(str(bgzf_file), readahead=1024 * 1024) as reader:
+        # The prefetch thread has read far ahead of this position already.
+        assert reader.read(10) == TEST_BLOCKS[0][:10]
+        reader.seek(second_block_offset << 16 | 10)
+        assert reader.read(20) == TEST_BLOCKS[1][10:30]
+
+
+def test_bgzf_reader_readahead_truncated(tmp_path: Path):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file)) as writer:
+        for block in TEST_BLOCKS:
+            writer.write_block(block)
+    truncated = bgzf_file.read_bytes()[:-40]
+    bgzf_file.write_bytes(truncated)
+    with BGZFReader(str(bgzf_file), readahead=1024 * 1024) as reader:
+        # The error raised in the prefetch thread surfaces in the consumer.
+        with pytest.raises(EOFError) as error:
+            list(reader)
+        error.match("Truncated")
+
+
+@pytest.mark.parametrize("writer_threads", [1, 2])
+def test_bgzf_writer_output_coalescing(tmp_path: Path, writer_threads: int):
+    # Write well over BGZF_OUTPUT_COALESCE_SIZE of incompressible level-0
+    # blocks so several coalesced writes plus a final partial one happen.
+    bgzf_file = tmp_path / "test.bgzf"
+    blocks = [bytes([i & 0xff]) * BGZF_BLOCK_SIZE for i in range(40)]
+    with BGZFWriter(str(bgzf_file), compresslevel=0,
+                    threads=writer_threads) as writer:
+        for block in blocks:
+            writer.write_block(block)
+    with BGZFReader(str(bgzf_file)) as reader:
+        assert list(reader) == blocks + [b""]
+
+
+@pytest.mark.parametrize("writer_threads", [1, 2])
+def test_gzi_round_trip(tmp_path: Path, writer_threads: int):
+    bgzf_file = tmp_path / "test.bgzf"
+    blocks = [b"%d" % i + b"x" * 1000 for i in range(50)]
+    with BGZFWriter(str(bgzf_file), threads=writer_threads,
+                    index=True) as writer:
+        for block in blocks:
+            writer.write_block(block)
+    assert (tmp_path / "test.bgzf.gzi").exists()
+    data = b"".join(blocks)
+    with BGZFReader(str(bgzf_file)) as reader:
+        # Seek to offsets in the first, a middle and the last block, plus
+        # an exact block boundary.
+        for offset in (0, 10, len(data) // 2, len(blocks[0]),
+                       len(data) - 10):
+            reader.seek_uncompressed(offset)
+            assert reader.read(10) == data[offset:offset + 10]
+
+
+def test_gzi_resume_scan(tmp_path: Path):
+    # Checkpoint an interrupted scan by uncompressed offset and resume it.
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file), index=True) as writer:
+        writer.write(b"0123456789" * 20000)
+    with BGZFReader(str(bgzf_file)) as reader:
+        reader.read(123_456)
+        checkpoint = 123_456
+    with BGZFReader(str(bgzf_file)) as reader:
+        reader.seek_uncompressed(checkpoint)
+        assert reader.read(10) == b"6789012345"
+
+
+def test_gzi_missing(tmp_path: Path):
+    bgzf_file = tmp_path / "test.bgzf"
+    with BGZFWriter(str(bgzf_file)) as writer:
+        writer.write_block(b"data")
+    with BGZFReader(str(bgzf_file)) as reader:
+        with pytest.raises(FileNotFoundError):
+            reader.seek_uncompressed(2)
+
+
+def test_read_gzi_truncated(tmp_path: Path):
+    gzi_file = tmp_path / "test.bgzf.gzi"
+    gzi_file.write_bytes(struct.pack("<Q", 2) + struct.pack("<QQ", 100, 200))
+    with pytest.raises(BGZFError) as error:
+        read_gzi(str(gzi_file))
+    error.match("Truncated")
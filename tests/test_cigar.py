@@ -20,6 +20,7 @@
 
 import array
 
+from htspy._bam import cigars_to_strings
 from htspy.bam import BAM_CBACK, BAM_CDEL, BAM_CDIFF, BAM_CEQUAL, \
     BAM_CHARD_CLIP, BAM_CINS, BAM_CMATCH, BAM_CPAD, BAM_CREF_SKIP, \
     BAM_CSOFT_CLIP, Cigar
@@ -111,3 +112,45 @@ def test_bam_cigar_from_buffer():
 def test_bam_cigar_richcompare():
     assert Cigar("8M") == Cigar("8M")
     assert Cigar("8M") != Cigar("7M")
+
+
+def test_bam_cigar_reference_length():
+    # M, D, N, = and X consume the reference; I, S, H and P do not.
+    cigar = Cigar("5S10M2I3D4N6=1X7M5H2P")
+    assert cigar.reference_length() == 10 + 3 + 4 + 6 + 1 + 7
+
+
+def test_bam_cigar_query_length():
+    # M, I, S, = and X consume the query; D, N, H and P do not.
+    cigar = Cigar("5S10M2I3D4N6=1X7M5H2P")
+    assert cigar.query_length() == 5 + 10 + 2 + 6 + 1 + 7
+
+
+def test_bam_cigar_clipped_lengths():
+    # Both soft and hard clips on either end count as clipped.
+    assert Cigar("2H5S100M3S").clipped_lengths() == (7, 3)
+    assert Cigar("100M").clipped_lengths() == (0, 0)
+    # A fully clipped cigar is counted as leading clips only.
+    assert Cigar("5S5H").clipped_lengths() == (10, 0)
+
+
+def test_bam_cigar_empty_lengths():
+    cigar = Cigar("")
+    assert cigar.reference_length() == 0
+    assert cigar.query_length() == 0
+    assert cigar.clipped_lengths() == (0, 0)
+
+
+def test_cigars_to_strings():
+    cigars = [Cigar(CIGAR_STRING), Cigar("5S10M"), Cigar("")]
+    assert cigars_to_strings(cigars) == [CIGAR_STRING, "5S10M", ""]
+
+
+def test_cigars_to_strings_empty():
+    assert cigars_to_strings([]) == []
+
+
+def test_cigars_to_strings_wrong_type():
+    with pytest.raises(TypeError) as error:
+        cigars_to_strings([Cigar("1M"), "2M"])
+    error.match("Cigar")
@@ -0,0 +1,279 @@
+# Copyright (c) 2022 Ruben Vorderman
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+import itertools
+import struct
+from pathlib import Path
+
+from htspy._bam import bam_iterator
+from htspy.bam import BAMFormatError, BamHeader, BamReader, BamReference, \
+    BamRecord, BamSorter, BamWriter
+from htspy.bgzf import BGZFReader, BGZFWriter, read_raw_bgzf_block
+from htspy.index import BAMIndexFormatError, BamIndex, ReferenceIndex, \
+    read_index, reg2bin, reg2bins
+
+import pytest
+
+
+def test_reg2bin():
+    # The smallest bin spanning [0, 16384) at the deepest level.
+    assert reg2bin(0, 16384) == 4681
+    assert reg2bin(16384, 32768) == 4682
+    # A region spanning two 16 kbp windows belongs to the parent bin.
+    assert reg2bin(16000, 17000) == 585
+    assert reg2bin(0, 2 ** 29) == 0
+
+
+def test_reg2bins():
+    bins = reg2bins(0, 16384)
+    assert 0 in bins  # root bin
+    assert 4681 in bins
+    assert 4682 not in bins
+    assert 4682 in reg2bins(16384, 32768)
+
+
+def test_first_offset():
+    reference = ReferenceIndex(
+        bins={4681: [(100 << 16, 200 << 16)],
+              4682: [(200 << 16, 300 << 16)]},
+        intervals=[100 << 16, 200 << 16])
+    index = BamIndex([reference])
+    assert index.first_offset(0, 0, 100) == 100 << 16
+    assert index.first_offset(0, 20000, 21000) == 200 << 16
+    # Unknown reference or empty bins: no records can overlap.
+    assert index.first_offset(1, 0, 100) is None
+    assert index.first_offset(0, 100000, 100100) is None
+
+
+def test_bgzf_seek(tmp_path: Path):
+    bgzf_file = tmp_path / "test.bgzf"
+    blocks = [b"first block", b"second block", b"third block"]
+    with BGZFWriter(str(bgzf_file)) as writer:
+        for block in blocks:
+            writer.write_block(block)
+    # Carve the raw blocks to learn their file offsets.
+    offsets = []
+    with open(bgzf_file, "rb") as raw:
+        for _ in blocks:
+            offsets.append(raw.tell())
+            read_raw_bgzf_block(raw)
+    with BGZFReader(str(bgzf_file)) as reader:
+        reader.seek(offsets[1] << 16)
+        assert reader.read(len(blocks[1])) == blocks[1]
+        reader.seek(offsets[2] << 16 | 6)
+        assert reader.read(5) == blocks[2][6:11]
+        reader.seek(offsets[0] << 16 | 6)
+        assert reader.read(5) == blocks[0][6:11]
+
+
+def indexed_bam(tmp_path: Path, positions):
+    """Write a coordinate-sorted one-reference BAM file plus a hand-built
+    BAI file that points at the single block holding the records."""
+    bam_file = tmp_path / "test.bam"
+    header = BamHeader("@SQ\tSN:chr1\tLN:100000\n",
+                       [BamReference("chr1", 100000)])
+    with BamWriter(str(bam_file), header) as writer:
+        for i, position in enumerate(positions):
+            writer.write(BamRecord(reference_id=0, position=position,
+                                   read_name=b"read%d" % i))
+    with open(bam_file, "rb") as raw:
+        # Skip the header block: the records block starts right after it.
+        read_raw_bgzf_block(raw)
+        records_start = raw.tell()
+        read_raw_bgzf_block(raw)
+        records_end = raw.tell()
+    chunk = (records_start << 16, records_end << 16)
+    bai = struct.pack("<4si", b"BAI\x01", 1)
+    bai += struct.pack("<i", 1)  # one bin
+    bai += struct.pack("<Ii", 4681, 1) + struct.pack("<QQ", *chunk)
+    bai += struct.pack("<iQ", 1, records_start << 16)  # linear index
+    (tmp_path / "test.bam.bai").write_bytes(bai)
+    return bam_file
+
+
+def test_fetch(tmp_path: Path):
+    bam_file = indexed_bam(tmp_path, [100, 150, 200, 5000, 9000])
+    with BamReader(str(bam_file)) as reader:
+        names = [record.read_name
+                 for record in reader.fetch("chr1", 120, 5001)]
+        assert names == ["read1", "read2", "read3"]
+        # Records without a CIGAR span one base.
+        assert [record.read_name for record in reader.fetch("chr1", 100, 101)] \
+            == ["read0"]
+        assert list(reader.fetch("chr1", 50000, 60000)) == []
+
+
+def test_fetch_unknown_reference(tmp_path: Path):
+    bam_file = indexed_bam(tmp_path, [100])
+    with BamReader(str(bam_file)) as reader:
+        with pytest.raises(ValueError) as error:
+            list(reader.fetch("chr2", 0, 100))
+        error.match("Unknown reference")
+
+
+def test_fetch_no_index(tmp_path: Path):
+    bam_file = indexed_bam(tmp_path, [100])
+    (tmp_path / "test.bam.bai").unlink()
+    with BamReader(str(bam_file)) as reader:
+        with pytest.raises(FileNotFoundError):
+            list(reader.fetch("chr1", 0, 100))
+
+
+def test_read_index_wrong_magic(tmp_path: Path):
+    index_file = tmp_path / "test.bam.bai"
+    index_file.write_bytes(b"NOPE" + b"\x00" * 16)
+    with pytest.raises(BAMIndexFormatError):
+        read_index(str(index_file))
+
+
+def test_record_larger_than_bgzf_block(tmp_path: Path):
+    # A 100 kb read does not fit in one BGZF block, so the record is
+    # spread over multiple blocks and reassembled while reading.
+    bam_file = tmp_path / "test.bam"
+    header = BamHeader("@SQ\tSN:chr1\tLN:100000\n",
+                       [BamReference("chr1", 100000)])
+    sequence = "ACGT" * 25000
+    with BamWriter(str(bam_file), header) as writer:
+        writer.write(BamRecord(read_name=b"small_before"))
+        big_record = BamRecord(read_name=b"big")
+        big_record.set_sequence(sequence)
+        writer.write(big_record)
+        writer.write(BamRecord(read_name=b"small_after"))
+    with BamReader(str(bam_file)) as reader:
+        records = list(reader)
+    assert [record.read_name for record in records] == \
+        ["small_before", "big", "small_after"]
+    assert records[1].get_sequence() == sequence
+
+
+def test_bam_writer_write_many(tmp_path: Path):
+    bam_file = tmp_path / "test.bam"
+    header = BamHeader("@SQ\tSN:chr1\tLN:100000\n",
+                       [BamReference("chr1", 100000)])
+    records = [BamRecord(read_name=b"read%d" % i) for i in range(2000)]
+    with BamWriter(str(bam_file), header) as writer:
+        writer.write_many(records)
+    with BamReader(str(bam_file)) as reader:
+        names = [record.read_name for record in reader]
+    assert names == ["read%d" % i for i in range(2000)]
+
+
+def test_bam_reader_writer_stats(tmp_path: Path):
+    bam_file = tmp_path / "test.bam"
+    header = BamHeader("@SQ\tSN:chr1\tLN:100000\n",
+                       [BamReference("chr1", 100000)])
+    with BamWriter(str(bam_file), header) as writer:
+        for i in range(100):
+            writer.write(BamRecord(read_name=b"read%d" % i))
+        assert writer.stats["records_written"] == 100
+        assert writer.stats["data_bytes"] > 0
+    with BamReader(str(bam_file)) as reader:
+        assert len(list(reader)) == 100
+        stats = reader.stats
+    assert stats["records_read"] == 100
+    assert stats["blocks_read"] >= 1
+    assert stats["decompressed_bytes"] > 0
+    assert stats["decompress_seconds"] > 0
+
+
+def test_bam_sorter(tmp_path: Path):
+    bam_file = tmp_path / "sorted.bam"
+    header = BamHeader("@HD\tVN:1.6\n@SQ\tSN:chr1\tLN:100000\n",
+                       [BamReference("chr1", 100000)])
+    positions = [(i * 7919) % 100000 for i in range(200)]
+    with BamSorter(str(bam_file), header) as sorter:
+        for i, position in enumerate(positions):
+            sorter.write(BamRecord(reference_id=0, position=position,
+                                   read_name=b"read%d" % i))
+    with BamReader(str(bam_file)) as reader:
+        assert reader.header.hd["SO"] == "coordinate"
+        read_positions = [record._pos for record in reader]
+    assert read_positions == sorted(positions)
+
+
+def test_bam_sorter_spills_runs(tmp_path: Path):
+    bam_file = tmp_path / "sorted.bam"
+    header = BamHeader("@SQ\tSN:chr1\tLN:100000\n",
+                       [BamReference("chr1", 100000)])
+    positions = [(i * 104729) % 100000 for i in range(2000)]
+    # A tiny memory limit forces several spilled runs plus an in-memory
+    # remainder that all have to be merged.
+    with BamSorter(str(bam_file), header, max_memory=4096) as sorter:
+        sorter.write_many(BamRecord(reference_id=0, position=position,
+                                    read_name=b"read%d" % i)
+                          for i, position in enumerate(positions))
+    with BamReader(str(bam_file)) as reader:
+        read_positions = [record._pos for record in reader]
+    assert read_positions == sorted(positions)
+
+
+@pytest.mark.parametrize("threads", [1, 4])
+def test_bam_reader_map_blocks(tmp_path: Path, threads: int):
+    bam_file = tmp_path / "test.bam"
+    header = BamHeader("@SQ\tSN:chr1\tLN:100000\n",
+                       [BamReference("chr1", 100000)])
+    with BamWriter(str(bam_file), header) as writer:
+        for i in range(5000):
+            writer.write(BamRecord(reference_id=0, position=i,
+                                   read_name=b"read%d" % i))
+
+    def names(data):
+        return [record.read_name for record in bam_iterator(data)]
+
+    with BamReader(str(bam_file)) as reader:
+        name_lists = list(reader.map_blocks(names, threads=threads))
+    # Several blocks were written, and concatenating the per-block results
+    # reconstructs the records in file order.
+    assert len(name_lists) > 1
+    assert list(itertools.chain.from_iterable(name_lists)) == \
+        ["read%d" % i for i in range(5000)]
+
+
+def test_bam_reader_map_blocks_invalid_threads(tmp_path: Path):
+    bam_file = indexed_bam(tmp_path, [100])
+    with BamReader(str(bam_file)) as reader:
+        with pytest.raises(ValueError) as error:
+            list(reader.map_blocks(len, threads=0))
+        error.match("threads")
+
+
+def test_bam_reader_truncated_record(tmp_path: Path):
+    bam_file = tmp_path / "test.bam"
+    header = BamHeader("@SQ\tSN:chr1\tLN:100000\n",
+                       [BamReference("chr1", 100000)])
+    with BamWriter(str(bam_file), header) as writer:
+        for i in range(5):
+            writer.write(BamRecord(reference_id=0, position=i,
+                                   read_name=b"read%d" % i))
+    with BGZFReader(str(bam_file)) as reader:
+        data = reader.readall()
+    # Rewrite the stream with the tail of the last record chopped off,
+    # as when a copy was interrupted mid-file.
+    truncated_file = tmp_path / "truncated.bam"
+    with BGZFWriter(str(truncated_file)) as writer:
+        writer.write_block(data[:-4])
+    with BamReader(str(truncated_file)) as reader:
+        with pytest.raises(BAMFormatError) as error:
+            list(reader)
+        error.match("Truncated")
+    with BamReader(str(truncated_file)) as reader:
+        with pytest.raises(BAMFormatError) as error:
+            list(reader.map_blocks(len))
+        error.match("Truncated")